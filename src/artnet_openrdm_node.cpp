@@ -6,26 +6,64 @@
 #include <string>
 #include <cstring>
 #include <thread>
-#include <mutex>
 #include <semaphore>
+#include <mutex>
+#include <condition_variable>
 #include <array>
-#include <queue>
 #include <chrono>
 #include <memory>
+#include <future>
+#include <cinttypes>
+#include <algorithm>
+#include <cerrno>
+
+#include <unistd.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <sys/timerfd.h>
 
 #include <artnet/artnet.h>
+#include <artnet/packets.h>
 #include <argparse/argparse.hpp>
 
 #include "rdm.hpp"
 #include "dmx.h"
 #include "openrdm_device.hpp"
 #include "openrdm_device_thread.hpp"
+#include "dmx_mailbox.hpp"
+#include "dmx_compare.hpp"
+#include "spsc_queue.hpp"
+#include "mpsc_queue.hpp"
+#include "openrdm_clock.hpp"
 
 #define SEMA_MAX 0xffff
-#define DMX_REFRESH_MS 50
+#define RDM_QUEUE_SIZE 64 // RDM requests waiting per port, more are dropped rather than wait on the RDM thread
+#define DMX_REFRESH_RATE_HZ 20 // Default refresh rate when DMX isn't changing
 #define RDM_SEMA_TIMEOUT_MS 1000
 #define RDM_INCREMENTAL_SCAN_INTERVAL_MS 5*60*1000 // 5 minutes
 static const unsigned int THREAD_REINIT_TIMEOUT_MS = 1000; // 1 second
+#define REACTOR_MAX_EVENTS 16
+#define REACTOR_RETRY_US 500 // How soon to retry a port whose device is still sending
+#define REACTOR_TAG_TIMER 0
+#define REACTOR_TAG_ARTNET 1
+#define REACTOR_TAG_ARTNET_TX 2
+#define REACTOR_TAG_HOTPLUG 3
+#define REACTOR_TAG_USB 4 // Plus the port
+#define HOTPLUG_OPEN_RETRIES 5 // A device that has just arrived can take a moment to be ready to open
+#define HOTPLUG_RETRY_MS 20
+#define ARTNET_TX_QUEUE_SIZE 256 // Outbound messages waiting for the network thread
+#define ARTNET_OP_SYNC 0x5200
+#define ARTSYNC_TIMEOUT_MS 4000 // Return to free running output when ArtSync stops, as the Art-Net spec asks
+#define ARTSYNC_LEAD_US 2000 // Frames released by ArtSync start their breaks this long after it, so every port is ready
+#define STATS_POLL_US 500 // How often the Art-Net thread checks whether the ports have answered a stats request
+#define PREFAULT_STACK_BYTES (256*1024) // Stack and heap touched up front with --lock-memory
+#define PREFAULT_HEAP_BYTES (4*1024*1024)
+#define THREAD_STACK_BYTES (256*1024) // Stack size of every thread started with --lock-memory
 
 bool verbose = 0;
 bool rdm_enabled = 0;
@@ -35,167 +73,442 @@ artnet_node node;
 auto ordm_dev = std::array<OpenRDMDevice, ARTNET_MAX_PORTS>();
 
 bool thread_exit = false;
-auto dmx_thread_sema = std::array<std::shared_ptr<std::counting_semaphore<SEMA_MAX>>, ARTNET_MAX_PORTS>();
 auto rdm_thread_sema = std::array<std::shared_ptr<std::counting_semaphore<SEMA_MAX>>, ARTNET_MAX_PORTS>();
-auto dmx_mutex = std::array<std::mutex, ARTNET_MAX_PORTS>(); // Use a seperate mutex for dmx so we don't lock the dmx unnecessarily
-auto data_mutex = std::array<std::mutex, ARTNET_MAX_PORTS>();
-auto data_dmx = std::array<DMXMessage, ARTNET_MAX_PORTS>();
-auto data_rdm = std::array<std::queue<RDMMessage>, ARTNET_MAX_PORTS>();
+std::atomic<bool> rdm_actor_wake = false; // The shared RDM thread has been woken to run the device actors
+auto dmx_mailbox = std::array<DMXMailbox, ARTNET_MAX_PORTS>();
+auto dmx_stats = std::array<DMXPortStats, ARTNET_MAX_PORTS>();
+// Filled by the Art-Net thread and emptied by the port's RDM thread, neither ever waits on the other
+auto rdm_queue = std::array<SPSCQueue<RDMMessage, RDM_QUEUE_SIZE>, ARTNET_MAX_PORTS>();
+auto rdm_dropped = std::array<uint64_t, ARTNET_MAX_PORTS>(); // Requests the full queue had no room for
+// Outbound Art-Net from every RDM thread, the network thread is the only one that uses the node
+auto artnet_tx_queue = MPSCQueue<ArtNetOutMessage, ARTNET_TX_QUEUE_SIZE>();
+int artnet_tx_fd = -1; // eventfd that wakes the network thread to send
+std::atomic<bool> artnet_tx_wake = false; // A wakeup is already on its way
+std::atomic<uint64_t> artnet_tx_dropped = 0; // Messages the full queue had no room for
+struct {
+    uint64_t batches = 0;
+    uint64_t messages = 0;
+    uint64_t batch_max = 0;
+    struct openrdm_interval_stats latency = {}; // Queued to sent
+} artnet_tx_stats; // Network thread only
+// Time spent in the Art-Net handlers, only touched by the thread that reads Art-Net and prints stats
+struct openrdm_interval_stats dmx_handler_time = {};
+struct openrdm_interval_stats rdm_handler_time = {};
+auto dmx_output_mode = std::array<DMXOutputMode, ARTNET_MAX_PORTS>();
+auto dmx_refresh_rate = std::array<double, ARTNET_MAX_PORTS>();
+auto dmx_state = std::array<DMXPortState, ARTNET_MAX_PORTS>();
+auto dmx_phase = std::array<double, ARTNET_MAX_PORTS>(); // Fraction of the refresh period to offset the port's frames by
+bool dmx_stagger = false;
+uint64_t dmx_epoch_ns = 0; // Common origin for the staggered frame clocks
+// ArtSync state, only touched by the thread that reads Art-Net and prints stats
+int artsync_timeout_ms = ARTSYNC_TIMEOUT_MS;
+bool artsync_active = false; // ArtDmx is staged until the next ArtSync
+uint64_t artsync_last_ns = 0;
+uint64_t artsync_release_ns = 0; // Break start of the frames the last ArtSync released
+struct in_addr artdmx_source = {}; // Sender of the last ArtDmx, ArtSync from anywhere else is ignored
+auto dmx_staged = std::array<DMXFrame, ARTNET_MAX_PORTS>();
+auto dmx_staged_fresh = std::array<bool, ARTNET_MAX_PORTS>();
+struct {
+    uint64_t releases = 0;
+    uint64_t timeouts = 0;
+    uint64_t ignored = 0; // ArtSync from other than the ArtDmx sender
+    struct openrdm_interval_stats skew = {}; // Spread of the break starts across the ports released together
+} artsync_stats;
+
+
+
+// USB hotplug: a port that lost its device after one left only tries to reopen it when one arrives
+bool hotplug_active = false;
+std::atomic<uint64_t> usb_arrivals = 0;
+std::atomic<uint64_t> usb_departures = 0;
+std::mutex port_event_mutex;
+std::condition_variable port_event_cv; // Notified when a device arrives or a port gets its device back
+int port_event_fd = -1; // eventfd doing the same for the reactor
+
+void port_event_notify() {
+    // Taking the mutex orders this against a waiter between checking and sleeping
+    port_event_mutex.lock();
+    port_event_mutex.unlock();
+    port_event_cv.notify_all();
+    uint64_t one = 1;
+    if (write(port_event_fd, &one, sizeof(one)) < 0) return;
+}
 
+// Called on the hotplug thread
+void usb_hotplug(int arrived, void *user) {
+    if (arrived) {
+        usb_arrivals++;
+        port_event_notify();
+    } else {
+        // The port finds out from its failed transfers
+        usb_departures++;
+    }
+}
 
+// Waits until deadline_ns, or until ready() is true after a device arrives or a port reconnects
+template <typename F>
+void port_event_wait(uint64_t deadline_ns, F &&ready) {
+    // Wake at least every second, for thread_exit
+    deadline_ns = std::min<uint64_t>(deadline_ns, monotonicNs() + 1000000000ULL);
+    std::unique_lock<std::mutex> lock(port_event_mutex);
+    waitOnClock(deadline_ns, [&](auto timeout) { return port_event_cv.wait_for(lock, timeout, ready); });
+}
+
+// Next frame time on the port's phase grid at or after t, so staggered ports on the same USB bus take turns
+uint64_t dmx_next_phase_ns(const DMXPortState &state, uint64_t t) {
+    if (!state.staggered) return t;
+    if (t <= state.phase_origin_ns) return state.phase_origin_ns;
+    return state.phase_origin_ns + (t - state.phase_origin_ns + state.period_ns - 1) / state.period_ns * state.period_ns;
+}
+
+void dmx_port_start(int port) {
+    auto &state = dmx_state[port];
+    state.continuous = dmx_output_mode[port] == DMXOutputMode::Continuous;
+    // A rate of 0 means as fast as the line allows
+    state.period_ns = dmx_refresh_rate[port] > 0 ? (uint64_t)(1e9 / dmx_refresh_rate[port]) : 0;
+    state.staggered = dmx_stagger && state.period_ns > 0;
+    state.phase_origin_ns = dmx_epoch_ns + (uint64_t)(dmx_phase[port] * state.period_ns);
+    state.t_last_ns = monotonicNs();
+    state.next_frame_ns = dmx_next_phase_ns(state, state.t_last_ns);
+}
+
+// When the port next needs servicing if no new DMX arrives
+uint64_t dmx_port_deadline(int port) {
+    auto &state = dmx_state[port];
+    if (!ordm_dev[port].isInitialized()) {
+        // A port waiting on hotplug is due as soon as a device arrives
+        if (state.reinit_ns == UINT64_MAX && usb_arrivals != state.arrivals_seen) return 0;
+        return state.reinit_ns;
+    }
+    if (state.continuous) return state.next_frame_ns;
+    // Unchanged frames only go out at the refresh rate, as a keepalive
+    uint64_t refresh_ns = std::max(state.period_ns, ordm_dev[port].getFrameTimeNs());
+    // Staggered keepalives go in the nearest slot, rounding up would double the period as t_last is after the slot
+    if (state.staggered) refresh_ns -= state.period_ns / 2;
+    return dmx_next_phase_ns(state, state.t_last_ns + refresh_ns);
+}
+
+// Sends the port's next frame, fresh is whether a new frame may be waiting in the mailbox
+// Returns false if block is false and the last frame was still being sent or the device is still opening,
+// the port should then be serviced again shortly
+// The per port threads and the reactor both send through here, so the same input gives the same bytes
+// on the line. Which frame a continuous refresh picks up still depends on when it runs
+bool dmx_port_service(int port, bool fresh, bool block) {
+    auto *dev = &ordm_dev[port];
+    auto &mailbox = dmx_mailbox[port];
+    auto &stats = dmx_stats[port];
+    auto &state = dmx_state[port];
+
+    // A device opened from the reactor is initialized before the reactor collects the result
+    if (!dev->isInitialized() || state.opening) {
+        uint64_t t_now = monotonicNs();
+        if (state.port_ok) {
+            std::cerr << "OPENRDM DMX Thread: Port " << std::to_string(port+1)
+                << " (" << dev->getDescription() << ") not initialized" << std::endl;
+            state.disconnect_ns = t_now;
+        }
+        state.port_ok = false;
+        if (!state.opening) {
+            if (hotplug_active && usb_arrivals != state.arrivals_seen) {
+                // Try straight away, and a few more times while the device settles
+                state.arrivals_seen = usb_arrivals;
+                state.open_retries = HOTPLUG_OPEN_RETRIES;
+            } else if (state.reinit_ns == 0) {
+                // Once a device has left there's no point trying again before one arrives
+                bool absent = hotplug_active && usb_departures != state.departures_seen;
+                state.reinit_ns = absent ? UINT64_MAX : t_now + THREAD_REINIT_TIMEOUT_MS * 1000000ULL;
+                return true;
+            } else if (t_now < state.reinit_ns) {
+                return true;
+            }
+            state.reinit_ns = 0;
+            stats.open_attempts++;
+            state.opening = dev->startInit();
+        }
+        // Opening takes a while, the reactor serves the other ports meanwhile
+        auto opened = dev->pollInit(block);
+        if (!opened) return false;
+        state.opening = false;
+        if (*opened) {
+            uint64_t reconnect_ns = monotonicNs() - state.disconnect_ns;
+            stats.reconnects++;
+            stats.reconnect_last_ns = reconnect_ns;
+            if (reconnect_ns > stats.reconnect_max_ns) stats.reconnect_max_ns = reconnect_ns;
+            state.arrivals_seen = usb_arrivals;
+            state.departures_seen = usb_departures;
+            port_event_notify();
+        } else if (state.open_retries > 0) {
+            state.open_retries--;
+            state.reinit_ns = monotonicNs() + HOTPLUG_RETRY_MS * 1000000ULL;
+        }
+        state.next_frame_ns = dmx_next_phase_ns(state, monotonicNs());
+        return true;
+    }
+    state.port_ok = true;
+
+    // Refresh the last frame on timeout, or in continuous mode every frame
+    bool transmit = state.continuous || !fresh;
+    uint64_t start_ns = 0;
+    if (fresh) {
+        // The front frame is handed to the transport without copying, so it can only be
+        // swapped for the newest frame once the previous transfer has finished with it
+        if (!dev->waitDMX(block)) return false;
+        if (mailbox.acquire()) {
+            auto &frame = mailbox.front();
+            if (frame.length == state.last_tx.length && dmxDataEqual(frame.data.data(), state.last_tx.data.data(), frame.length)) {
+                stats.deduplicated++;
+            } else {
+                std::copy_n(frame.data.begin(), frame.length, state.last_tx.data.begin());
+                state.last_tx.length = frame.length;
+                stats.changed++;
+                transmit = true;
+                start_ns = frame.start_ns;
+            }
+        }
+    }
+
+    if (transmit) {
+        auto &frame = mailbox.front();
+        dev->writeDMX(frame.data.data(), frame.length, start_ns);
+        state.t_last_ns = monotonicNs();
+    }
+
+    if (state.continuous) {
+        // At or above the line rate writeDMX paces us by waiting for the previous frame to finish
+        state.next_frame_ns += state.period_ns > dev->getFrameTimeNs() ? state.period_ns : 0;
+        // If we fell behind (USB stall, RDM transaction) restart the clock rather than bursting to catch up
+        uint64_t t_now = monotonicNs();
+        if (state.next_frame_ns < t_now) state.next_frame_ns = dmx_next_phase_ns(state, t_now);
+    }
+    return true;
+}
 
 void dmx_thread(int port) {
     auto *dev = &ordm_dev[port];
-    auto sema = dmx_thread_sema[port];
+    auto &mailbox = dmx_mailbox[port];
     if (!dev->isInitialized()) return;
-    
-    int length;
-    uint8_t data[DMX_MAX_LENGTH];
-    bool dmx_changed = false;
-    auto t_last = std::chrono::high_resolution_clock::now();
-    bool port_ok = true;
+    attachThreadOpenRDM();
+    dmx_port_start(port);
 
     while (!thread_exit) {
-        bool sema_acquired = sema->try_acquire_for(std::chrono::milliseconds(DMX_REFRESH_MS));
+        uint64_t deadline_ns = dmx_port_deadline(port);
+        bool fresh = false;
         if (!dev->isInitialized()) {
-            if (port_ok) std::cerr << "OPENRDM DMX Thread: Port " << std::to_string(port+1)
-                    << " (" << dev->getDescription() << ") not initialized" << std::endl;
-            port_ok = false;
-            if (thread_exit) break;
-            std::this_thread::sleep_for(std::chrono::milliseconds(THREAD_REINIT_TIMEOUT_MS));
-            if (thread_exit) break;
-            dev->init();
-            continue;
+            port_event_wait(deadline_ns, [&] { return usb_arrivals != dmx_state[port].arrivals_seen; });
+        } else if (dmx_state[port].continuous) {
+            // Absolute deadlines so the frame clock doesn't drift with wakeup latency
+            waitUntilNs(deadline_ns);
+            fresh = true;
+        } else {
+            fresh = waitOnClock(deadline_ns, [&](auto timeout) {
+                return mailbox.wait_until(std::chrono::steady_clock::now() + timeout);
+            });
+        }
+        dmx_port_service(port, fresh, true);
+    }
+    detachThreadOpenRDM();
+}
+
+// Queues a message for the network thread to send, from any thread and without waiting
+void artnet_queue_send(ArtNetOutMessage &msg) {
+    msg.queued_ns = monotonicNs();
+    if (!artnet_tx_queue.push(msg)) {
+        artnet_tx_dropped++;
+        return;
+    }
+    // One wakeup covers everything queued until the network thread starts sending
+    if (!artnet_tx_wake.exchange(true)) {
+        uint64_t one = 1;
+        if (write(artnet_tx_fd, &one, sizeof(one)) < 0) artnet_tx_wake = false;
+    }
+}
+
+// Sends everything queued so far, on the network thread. Discovered devices queued together
+// for a port go out as one TOD update
+void artnet_send_queued() {
+    uint64_t wakeups;
+    if (read(artnet_tx_fd, &wakeups, sizeof(wakeups)) < 0 && errno != EAGAIN) return;
+    artnet_tx_wake = false;
+
+    auto added = std::array<std::vector<uint8_t>, ARTNET_MAX_PORTS>();
+    auto send_added = [&](int port) {
+        if (added[port].empty()) return;
+        artnet_add_rdm_devices(node, port, added[port].data(), added[port].size() / RDM_UID_LENGTH);
+        added[port].clear();
+    };
+    ArtNetOutMessage msg;
+    uint64_t count = 0;
+    while (artnet_tx_queue.pop(msg)) {
+        switch (msg.type) {
+            case ArtNetOutType::RDM:
+                artnet_send_rdm(node, msg.address, msg.data.data(), msg.length);
+                break;
+            case ArtNetOutType::AddDevices:
+                added[msg.address].insert(added[msg.address].end(), msg.data.begin(), msg.data.begin()+msg.length);
+                break;
+            case ArtNetOutType::RemoveDevice:
+                // Keep adds and removes of the port in order
+                send_added(msg.address);
+                artnet_remove_rdm_device(node, msg.address, msg.data.data());
+                break;
+        }
+        recordInterval(&artnet_tx_stats.latency, monotonicNs() - msg.queued_ns);
+        count++;
+    }
+    for (int port = 0; port < num_ports; port++) send_added(port);
+    if (count == 0) return;
+    artnet_tx_stats.batches++;
+    artnet_tx_stats.messages += count;
+    artnet_tx_stats.batch_max = std::max(artnet_tx_stats.batch_max, count);
+}
+
+// Queues discovered and lost devices to be sent to the controllers
+void rdm_report_changes(int port, const UIDList &added, const UIDList &removed) {
+    ArtNetOutMessage msg;
+    msg.type = ArtNetOutType::AddDevices;
+    msg.address = port;
+    msg.length = 0;
+    for (auto &uid : added) {
+        writeUID(msg.data.data()+msg.length, uid);
+        msg.length += RDM_UID_LENGTH;
+        if (msg.length + RDM_UID_LENGTH > (int)msg.data.size()) {
+            artnet_queue_send(msg);
+            msg.length = 0;
         }
-        port_ok = true;
-        
-        if (sema_acquired) {
-            dmx_mutex[port].lock();
-            dmx_changed = data_dmx[port].changed;
-            if (dmx_changed) {
-                length = data_dmx[port].length;
-                std::copy_n(data_dmx[port].data.data(), length, data);
-                data_dmx[port].changed = false;
+    }
+    if (msg.length > 0) artnet_queue_send(msg);
+    msg.type = ArtNetOutType::RemoveDevice;
+    msg.length = RDM_UID_LENGTH;
+    for (auto &uid : removed) {
+        writeUID(msg.data.data(), uid);
+        artnet_queue_send(msg);
+    }
+}
+
+// Handles one queued RDM message if sema_acquired, reports a finished discovery, then starts any
+// incremental scan that is due. Discovery runs in the background on the device, so messages are
+// still handled while it does
+// Returns false if the port isn't initialized
+bool rdm_port_service(int port, bool sema_acquired, RDMPortState &state) {
+    auto *dev = &ordm_dev[port];
+    if (!dev->isInitialized()) {
+        if (state.port_ok) std::cerr << "OPENRDM RDM Thread: Port " << std::to_string(port+1)
+                << " (" << dev->getDescription() << ") not initialized" << std::endl;
+        state.port_ok = false;
+        return false;
+    }
+    state.port_ok = true;
+    // Wake the RDM thread when discovery finishes, the message queue will be empty
+    auto discovery_done = [port] { rdm_thread_sema[port]->release(); };
+    if (sema_acquired) {
+        // Handle RDM messages 1 message at a time so we don't halt the dmx too much
+        RDMMessage msg;
+        bool has_msg = rdm_queue[port].pop(msg);
+
+        if (has_msg) {
+            auto actual_len = msg.length;
+            // Check SUB START CODE (in case new RDM version has different packet structure)
+            if (msg.length > 2 && msg.data[0] == RDM_SUB_START_CODE) {
+                actual_len = std::min(actual_len, 1+msg.data[1]);
             }
-            dmx_mutex[port].unlock();
 
-            if (dmx_changed) {
-                dev->writeDMX(data, length);
-                t_last = std::chrono::high_resolution_clock::now();
+            if (msg.length > 0) {
+                auto resp = ordm_dev[port].writeRDM(msg.data.data(), actual_len);
+                if (resp.first > 1) {
+                    if (resp.second[0] == RDM_START_CODE) {
+                        // Trim off START Code (0xCC)
+                        ArtNetOutMessage out;
+                        out.type = ArtNetOutType::RDM;
+                        out.address = msg.address;
+                        out.length = resp.first-1;
+                        std::copy_n(resp.second.begin()+1, out.length, out.data.begin());
+                        artnet_queue_send(out);
+                    }
+                }
+            } else { // 0 length means full RDM Discovery
+                if (ordm_dev[port].startFullRDMDiscovery(discovery_done))
+                    std::cout << "Starting Full RDM Discovery on Port: " << port << std::endl;
             }
         }
-        
-        auto t_now = std::chrono::high_resolution_clock::now();
-        double elapsed_time_ms = std::chrono::duration<double, std::milli>(t_now-t_last).count();
-        if (!sema_acquired || elapsed_time_ms > DMX_REFRESH_MS) {
-            // Timed out, DMX refresh
-            dmx_mutex[port].lock();
-            length = data_dmx[port].length;
-            std::copy_n(data_dmx[port].data.data(), length, data);
-            dmx_mutex[port].unlock();
+    }
+
+    if (auto changes = ordm_dev[port].pollRDMDiscovery()) {
+        rdm_report_changes(port, changes->added, changes->removed);
+        printf("Finished RDM Discovery on Port: %d, %" PRIu64 " DUBs averaging %.2f ms\n", port,
+            changes->dubs, changes->dubs > 0 ? changes->dub_ns / 1e6 / changes->dubs : 0.0);
+        state.i_scan_last_ns = monotonicNs();
+    }
 
-            dev->writeDMX(data, length);
-            t_last = std::chrono::high_resolution_clock::now();
+    if (incremental_scan) {
+        if (monotonicNs() - state.i_scan_last_ns > RDM_INCREMENTAL_SCAN_INTERVAL_MS * 1000000ULL) {
+            if (ordm_dev[port].startIncrementalRDMDiscovery(discovery_done))
+                std::cout << "Starting Incremental RDM Discovery on Port: " << port << std::endl;
         }
     }
+    return true;
 }
 
 void rdm_thread(int port) {
     auto *dev = &ordm_dev[port];
     auto sema = rdm_thread_sema[port];
     if (!dev->isInitialized()) return;
-    
-    auto i_scan_last = std::chrono::high_resolution_clock::now();
-    bool port_ok = true;
+    attachThreadOpenRDM();
+    RDMPortState state;
 
     while (!thread_exit) {
-        bool sema_acquired = sema->try_acquire_for(std::chrono::milliseconds(RDM_SEMA_TIMEOUT_MS));
-        if (!dev->isInitialized()) {
-            if (port_ok) std::cerr << "OPENRDM RDM Thread: Port " << std::to_string(port+1)
-                    << " (" << dev->getDescription() << ") not initialized" << std::endl;
-            port_ok = false;
+        bool sema_acquired = waitOnClock(monotonicNs() + RDM_SEMA_TIMEOUT_MS * 1000000ULL, [&](auto timeout) {
+            return sema->try_acquire_for(timeout);
+        });
+        if (!rdm_port_service(port, sema_acquired, state)) {
             if (thread_exit) break;
-            std::this_thread::sleep_for(std::chrono::milliseconds(THREAD_REINIT_TIMEOUT_MS));
-            continue;
+            port_event_wait(monotonicNs() + THREAD_REINIT_TIMEOUT_MS * 1000000ULL, [&] { return dev->isInitialized(); });
         }
-        port_ok = true;
-        if (sema_acquired) {
-            data_mutex[port].lock();
-            // Handle RDM messages 1 message at a time so we don't halt the dmx too much
-            if (!data_rdm[port].empty()) {
-                auto msg = data_rdm[port].front();
-                data_rdm[port].pop();
-
-                auto actual_len = msg.length;
-                // Check SUB START CODE (in case new RDM version has different packet structure)
-                if (msg.length > 2 && msg.data[0] == RDM_SUB_START_CODE) {
-                    actual_len = std::min(actual_len, 1+msg.data[1]);
-                }
+    }
+    detachThreadOpenRDM();
+}
 
-                if (msg.length > 0) {
-                    auto resp = ordm_dev[port].writeRDM(msg.data.data(), actual_len);
-                    if (resp.first > 1) {
-                        if (resp.second[0] == RDM_START_CODE) {
-                            // Trim off START Code (0xCC)
-                            artnet_send_rdm(node, msg.address, resp.second.begin()+1, resp.first-1);
-                        }
-                    }
-                } else { // 0 length means full RDM Discovery
-                    if (ordm_dev[port].rdm_enabled)
-                        std::cout << "Starting Full RDM Discovery on Port: " << port << std::endl;
-                    auto tod = ordm_dev[port].fullRDMDiscovery();
-                    if (tod.size() > 0) {
-                        auto uids = std::vector<uint8_t>();
-                        auto num_uids = 0;
-                        for (auto &uid : tod) {
-                            auto uid_raw = std::array<uint8_t, RDM_UID_LENGTH>();
-                            writeUID(uid_raw.data(), uid);
-                            uids.insert(uids.end(), uid_raw.begin(), uid_raw.end());
-                            num_uids++;
-                        }
-                        if (num_uids > 0) artnet_add_rdm_devices(node, port, uids.data(), num_uids);
-                    }
-                    i_scan_last = std::chrono::high_resolution_clock::now();
-                }
-            }
-            data_mutex[port].unlock();
-        }
-        
-        auto t_now = std::chrono::high_resolution_clock::now();
-
-        if (incremental_scan) {
-            auto elapsed_time_ms = std::chrono::duration<double, std::milli>(t_now-i_scan_last).count();
-            if (elapsed_time_ms > RDM_INCREMENTAL_SCAN_INTERVAL_MS) {
-                if (ordm_dev[port].rdm_enabled)
-                    std::cout << "Starting Incremental RDM Discovery on Port: " << port << std::endl;
-                auto tod_changes = ordm_dev[port].incrementalRDMDiscovery();
-                auto added = tod_changes.first;
-                if (added.size() > 0) {
-                    auto uids = std::vector<uint8_t>();
-                    auto num_uids = 0;
-                    for (auto &uid : added) {
-                        auto uid_raw = std::array<uint8_t, RDM_UID_LENGTH>();
-                        writeUID(uid_raw.data(), uid);
-                        uids.insert(uids.end(), uid_raw.begin(), uid_raw.end());
-                        num_uids++;
-                    }
-                    if (num_uids > 0) artnet_add_rdm_devices(node, port, uids.data(), num_uids);
-                }
-                auto removed = tod_changes.second;
-                for (auto &uid : removed) {
-                    auto uid_raw = std::array<uint8_t, RDM_UID_LENGTH>();
-                    writeUID(uid_raw.data(), uid);
-                    artnet_remove_rdm_device(node, port, uid_raw.data());
-                }
-                i_scan_last = std::chrono::high_resolution_clock::now();
-            }
+// In reactor mode every port shares one RDM thread and one semaphore, released once per queued message
+// and when a device actor has something to run. The devices have no threads of their own, their RDM
+// commands and timers run here and their DMX commands on the reactor
+void rdm_shared_thread() {
+    auto sema = rdm_thread_sema[0];
+    auto state = std::array<RDMPortState, ARTNET_MAX_PORTS>();
+    auto active = std::array<bool, ARTNET_MAX_PORTS>();
+    for (int port = 0; port < num_ports; port++) active[port] = ordm_dev[port].isInitialized();
+    int next_port = 0;
+    attachThreadOpenRDM();
+
+    while (!thread_exit) {
+        rdm_actor_wake = false;
+        bool queued = false;
+        uint64_t deadline_ns = monotonicNs() + RDM_SEMA_TIMEOUT_MS * 1000000ULL;
+        for (int port = 0; port < num_ports; port++) {
+            queued |= ordm_dev[port].runQueued(OpenRDMPriority::RDM);
+            deadline_ns = std::min(deadline_ns, ordm_dev[port].nextTimerNs());
+        }
+        // Commands still queued get another turn straight away, after the other ports have had theirs
+        bool sema_acquired = queued ? sema->try_acquire() : waitOnClock(deadline_ns, [&](auto timeout) {
+            return sema->try_acquire_for(timeout);
+        });
+        // Take the message from the ports in turn, so a busy port can't starve the others
+        int msg_port = -1;
+        for (int i = 0; sema_acquired && i < num_ports && msg_port < 0; i++) {
+            int port = (next_port + i) % num_ports;
+            if (active[port] && !rdm_queue[port].empty()) msg_port = port;
+        }
+        if (msg_port >= 0) next_port = (msg_port + 1) % num_ports;
+        for (int port = 0; port < num_ports; port++) {
+            if (active[port]) rdm_port_service(port, port == msg_port, state[port]);
         }
     }
+    detachThreadOpenRDM();
 }
 
 
+// The Art-Net handlers only hand work to other threads, so they never wait on a device
 int rdm_handler(artnet_node n, int address, uint8_t *rdm, int length, void *d) {
     if (length == 0) return 0;
+    uint64_t t_start = monotonicNs();
     if (verbose)
         printf("got rdm data for address %d, of length %d\n", address, length);
 
@@ -207,16 +520,17 @@ int rdm_handler(artnet_node n, int address, uint8_t *rdm, int length, void *d) {
 
         RDMMessage msg;
         msg.address = address;
-        msg.length = length;
-        std::copy_n(rdm, length, msg.data.begin());
-
-        data_mutex[port].lock();
-        data_rdm[port].push(msg);
-        data_mutex[port].unlock();
+        msg.length = std::min(length, (int)msg.data.size());
+        std::copy_n(rdm, msg.length, msg.data.begin());
 
+        if (!rdm_queue[port].push(msg)) {
+            rdm_dropped[port]++;
+            continue;
+        }
         rdm_thread_sema[port]->release();
     }
 
+    recordInterval(&rdm_handler_time, monotonicNs() - t_start);
     return 0;
 }
 
@@ -226,32 +540,450 @@ int rdm_initiate(artnet_node n, int port, void *d) {
     RDMMessage msg; // Length 0 means full RDM Discovery
     msg.length = 0;
 
-    data_mutex[port].lock();
-    data_rdm[port].push(msg);
-    data_mutex[port].unlock();
-
+    if (!rdm_queue[port].push(msg)) {
+        rdm_dropped[port]++;
+        return 0;
+    }
     rdm_thread_sema[port]->release();
     
     return 0;
 }
 
+// When artsync_check_timeout next has anything to do
+uint64_t artsync_deadline() {
+    return artsync_active ? artsync_last_ns + artsync_timeout_ms * 1000000ULL + 1 : UINT64_MAX;
+}
+
+// Goes back to free running output once ArtSync has stopped for artsync_timeout_ms
+void artsync_check_timeout(uint64_t t_now) {
+    if (!artsync_active || t_now < artsync_deadline()) return;
+    std::cout << "ArtSync timed out, DMX output is free running" << std::endl;
+    artsync_active = false;
+    artsync_stats.timeouts++;
+    // Staged frames the missing ArtSync never released go out now
+    for (int port = 0; port < num_ports; port++) {
+        if (!dmx_staged_fresh[port]) continue;
+        dmx_mailbox[port].back() = dmx_staged[port];
+        dmx_mailbox[port].publish();
+        dmx_staged_fresh[port] = false;
+    }
+}
+
 int dmx_handler(artnet_node n, int port, void *d) { 
     if (port >= num_ports) return 0;
+    uint64_t t_start = monotonicNs();
 
     int len;
     uint8_t *data = artnet_read_dmx(n, port, &len);
+    len = std::clamp(len, 0, DMX_MAX_LENGTH);
 
-    data_mutex[port].lock();
-    std::copy_n(data, len, data_dmx[port].data.begin());
-    data_dmx[port].length = len;
-    data_dmx[port].changed = true;
-    data_mutex[port].unlock();
+    artsync_check_timeout(t_start);
 
-    dmx_thread_sema[port]->release();
+    // The only copy between the network and USB, straight into the mailbox with the start code,
+    // or into the staging frame when the next ArtSync releases it
+    auto &frame = artsync_active ? dmx_staged[port] : dmx_mailbox[port].back();
+    frame.data[0] = DMX_START_CODE;
+    std::copy_n(data, len, frame.data.begin()+1);
+    frame.length = len+1;
+    frame.start_ns = 0;
+    if (artsync_active) {
+        dmx_staged_fresh[port] = true;
+    } else {
+        dmx_mailbox[port].publish();
+    }
+    dmx_stats[port].received++;
 
+    recordInterval(&dmx_handler_time, monotonicNs() - t_start);
     return 0;
 }
 
+// Releases the frames staged since the last ArtSync on every port at once
+void artsync_handler() {
+    uint64_t t_now = monotonicNs();
+    if (!artsync_active) std::cout << "ArtSync received, DMX output is synchronous" << std::endl;
+    artsync_active = true;
+    artsync_last_ns = t_now;
+
+    // The ports released last time have sent their frames by now
+    if (artsync_release_ns) {
+        uint64_t first_ns = UINT64_MAX, last_ns = 0;
+        int ports = 0;
+        for (int port = 0; port < num_ports; port++) {
+            uint64_t break_ns = ordm_dev[port].getTimedBreakNs();
+            if (break_ns < artsync_release_ns) continue;
+            first_ns = std::min(first_ns, break_ns);
+            last_ns = std::max(last_ns, break_ns);
+            ports++;
+        }
+        if (ports > 1) recordInterval(&artsync_stats.skew, last_ns - first_ns);
+        artsync_release_ns = 0;
+    }
+
+    uint64_t release_ns = t_now + ARTSYNC_LEAD_US * 1000ULL;
+    for (int port = 0; port < num_ports; port++) {
+        if (!dmx_staged_fresh[port]) continue;
+        auto &frame = dmx_mailbox[port].back();
+        frame = dmx_staged[port];
+        frame.start_ns = release_ns;
+        dmx_mailbox[port].publish();
+        dmx_staged_fresh[port] = false;
+        artsync_release_ns = release_ns;
+    }
+    artsync_stats.releases++;
+}
+
+// Sees every Art-Net packet before libartnet, which has no ArtSync support
+int artnet_recv_handler(artnet_node n, void *pp, void *d) {
+    auto packet = static_cast<artnet_packet>(pp);
+    if (artsync_timeout_ms == 0) return 0;
+    if (packet->type == ARTNET_DMX) {
+        artdmx_source = packet->from;
+        return 0;
+    }
+    if (packet->type != ARTNET_OP_SYNC) return 0;
+    if (packet->from.s_addr != artdmx_source.s_addr) {
+        // Another controller's ArtSync would release frames it didn't send
+        artsync_stats.ignored++;
+        return 1;
+    }
+    artsync_handler();
+    return 1; // Handled, libartnet would report it as unknown
+}
+
+void print_interval_stats(const char *name, const struct openrdm_interval_stats &stats) {
+    if (stats.count == 0) return;
+    printf("  %s: min %.1f us, avg %.1f us, max %.1f us, sd %.1f us\n", name, stats.min_ns / 1e3,
+        (double)stats.total_ns / stats.count / 1e3, stats.max_ns / 1e3, intervalStdDevUs(&stats));
+}
+
+// port_stats holds each port's device stats, gathered by the caller so the reactor needn't wait on the devices
+void print_stats(const std::array<struct openrdm_stats, ARTNET_MAX_PORTS> &port_stats) {
+    if (dmx_handler_time.count > 0 || rdm_handler_time.count > 0) {
+        printf("Art-Net Handlers:\n");
+        print_interval_stats("ArtDmx Handler", dmx_handler_time);
+        print_interval_stats("ArtRdm Handler", rdm_handler_time);
+    }
+    if (artnet_tx_stats.batches > 0 || artnet_tx_dropped > 0) {
+        printf("Art-Net Output: %" PRIu64 " messages in %" PRIu64 " batches (max %" PRIu64 "), %" PRIu64 " dropped\n",
+            artnet_tx_stats.messages, artnet_tx_stats.batches, artnet_tx_stats.batch_max, artnet_tx_dropped.load());
+        print_interval_stats("Send Queue Latency", artnet_tx_stats.latency);
+    }
+    if (artsync_stats.releases > 0) {
+        printf("ArtSync: %" PRIu64 " releases, %" PRIu64 " timeouts, %" PRIu64 " ignored, %s\n", artsync_stats.releases,
+            artsync_stats.timeouts, artsync_stats.ignored, artsync_active ? "synchronous" : "free running");
+        print_interval_stats("Cross-Port Break Skew", artsync_stats.skew);
+    }
+    for (int port = 0; port < num_ports; port++) {
+        if (ordm_dev[port].getDescription().size() == 0) continue;
+        auto &stats = port_stats[port];
+        double blocked_avg_ms = stats.dmx_frames > 0 ? (double)stats.dmx_blocked_ns / stats.dmx_frames / 1e6 : 0;
+        double control_per_frame = stats.dmx_frames > 0 ? (double)stats.dmx_control_transfers / stats.dmx_frames : 0;
+        printf("Port %d (%s):\n", port+1, ordm_dev[port].getDescription().c_str());
+        printf("  DMX Frames: %" PRIu64 " received, %" PRIu64 " changed, %" PRIu64 " deduplicated, %" PRIu64 " transmitted\n",
+            dmx_stats[port].received.load(), dmx_stats[port].changed.load(),
+            dmx_stats[port].deduplicated.load(), stats.dmx_frames);
+        printf("  DMX Blocked: avg %.3f ms, max %.3f ms, Slots/Frame: %.1f\n",
+            blocked_avg_ms, (double)stats.dmx_blocked_max_ns / 1e6,
+            stats.dmx_frames > 0 ? (double)stats.dmx_slots / stats.dmx_frames : 0);
+        printf("  USB Transfers: %" PRIu64 " control (%.2f/frame), %" PRIu64 " bulk, "
+            "Purges: %" PRIu64 " performed, %" PRIu64 " skipped\n",
+            stats.control_transfers, control_per_frame, stats.bulk_transfers,
+            stats.purges, stats.purges_skipped);
+        if (dmx_stats[port].open_attempts > 0) {
+            printf("  Reconnects: %" PRIu64 " (last %.1f ms, max %.1f ms), Open Attempts: %" PRIu64 "\n",
+                dmx_stats[port].reconnects.load(), dmx_stats[port].reconnect_last_ns / 1e6,
+                dmx_stats[port].reconnect_max_ns / 1e6, dmx_stats[port].open_attempts.load());
+        }
+        print_interval_stats("Break", stats.break_time);
+        print_interval_stats("MAB", stats.mab_time);
+        print_interval_stats("Frame Interval", stats.frame_interval);
+        print_interval_stats("TX Latency", stats.tx_latency);
+        print_interval_stats("RDM Transaction", stats.rdm_time);
+        print_interval_stats("RDM Response", stats.rdm_response_time);
+        print_interval_stats("DUB", stats.dub_time);
+        if (stats.rdm_time.count > 0) printf("  DMX Gap Refreshes: %" PRIu64 "\n", stats.dmx_gap_refreshes);
+        auto rdm_stats = ordm_dev[port].getRDMStats();
+        if (rdm_stats.pauses > 0) printf("  Discovery Pauses: %" PRIu64 ", Remutes: %" PRIu64 "\n", rdm_stats.pauses, rdm_stats.remutes);
+        print_interval_stats("Controller RDM Latency During Discovery", rdm_stats.controller_latency);
+        if (rdm_stats.ack_timers > 0) printf("  ACK_TIMER Waits: %" PRIu64 " (%" PRIu64 " pending), Pauses During Them: %" PRIu64 "\n",
+            rdm_stats.ack_timers, rdm_stats.ack_timers_pending, rdm_stats.ack_timer_pauses);
+        if (rdm_dropped[port] > 0) printf("  RDM Requests Dropped (Queue Full): %" PRIu64 "\n", rdm_dropped[port]);
+        auto all_uid_stats = ordm_dev[port].getUIDStats();
+        uint64_t quarantined = 0, quarantines = 0, skipped = 0, probes = 0, saved_ns = 0;
+        for (auto &[uid, uid_stats] : all_uid_stats) {
+            printf("  UID %012" PRIx64 ": %" PRIu64 " requests, %" PRIu64 " responses, %" PRIu64 " retries",
+                uid, uid_stats.requests, uid_stats.responses, uid_stats.retries);
+            if (uid_stats.response_time.count > 0) printf(", response avg %.2f ms, max %.2f ms",
+                (double)uid_stats.response_time.total_ns / uid_stats.response_time.count / 1e6,
+                uid_stats.response_time.max_ns / 1e6);
+            if (uid_stats.timeoutUs() > 0) printf(", timeout %.2f ms", uid_stats.timeoutUs() / 1e3);
+            if (uid_stats.quarantined) printf(", quarantined");
+            printf("\n");
+            quarantined += uid_stats.quarantined;
+            quarantines += uid_stats.quarantines;
+            skipped += uid_stats.skipped;
+            probes += uid_stats.probes;
+            saved_ns += uid_stats.saved_ns;
+        }
+        if (quarantines > 0) {
+            printf("  RDM Quarantine: %" PRIu64 " UIDs (%" PRIu64 " quarantines), %" PRIu64 " requests answered locally, %"
+                PRIu64 " probes, %.1f ms bus time saved\n", quarantined, quarantines, skipped, probes, saved_ns / 1e6);
+        }
+        auto queue = ordm_dev[port].getQueueStats();
+        size_t dmx = static_cast<size_t>(OpenRDMPriority::DMX), rdm = static_cast<size_t>(OpenRDMPriority::RDM);
+        printf("  Queue Depth: DMX %" PRIu64 " (max %" PRIu64 "), RDM %" PRIu64 " (max %" PRIu64 ")\n",
+            queue.depth[dmx], queue.depth_max[dmx], queue.depth[rdm], queue.depth_max[rdm]);
+        print_interval_stats("DMX Queue Wait", queue.wait[dmx]);
+        print_interval_stats("RDM Queue Wait", queue.wait[rdm]);
+    }
+}
+
+// Port stats are gathered on the device actors, so the thread reading Art-Net requests them and
+// prints them once every port has answered instead of waiting on a busy device
+auto pending_stats = std::array<std::future<struct openrdm_stats>, ARTNET_MAX_PORTS>();
+bool stats_pending = false;
+
+void request_stats() {
+    for (int port = 0; port < num_ports; port++) {
+        if (ordm_dev[port].getDescription().size() > 0) pending_stats[port] = ordm_dev[port].requestStats();
+    }
+    stats_pending = true;
+}
+
+// Prints the requested stats if every port has answered
+void poll_stats() {
+    if (!stats_pending) return;
+    if (!std::all_of(pending_stats.begin(), pending_stats.end(), [](auto &result) {
+            return !result.valid() || result.wait_for(std::chrono::seconds(0)) == std::future_status::ready; })) return;
+    auto port_stats = std::array<struct openrdm_stats, ARTNET_MAX_PORTS>();
+    for (int port = 0; port < num_ports; port++) {
+        if (pending_stats[port].valid()) port_stats[port] = pending_stats[port].get();
+    }
+    print_stats(port_stats);
+    stats_pending = false;
+}
+
+// Options that take one value per port, a single value applies to every port
+template <typename T>
+std::array<T, ARTNET_MAX_PORTS> get_port_values(argparse::ArgumentParser &program, const std::string &name) {
+    auto values = program.get<std::vector<T>>(name);
+    auto port_values = std::array<T, ARTNET_MAX_PORTS>();
+    for (size_t i = 0; i < ARTNET_MAX_PORTS; i++)
+        port_values[i] = values.at(std::min(i, values.size()-1));
+    return port_values;
+}
+
+// Scheduling for a thread, the priority is only used with a real-time policy
+struct ThreadSched {
+    int policy = SCHED_OTHER;
+    int priority = 0;
+    int cpu = -1; // -1 to run on any core
+};
+
+auto sched_threads = std::vector<std::pair<std::string, pthread_t>>(); // Threads for the startup report
+
+void set_thread_sched(pthread_t thread, const std::string &name, const ThreadSched &sched) {
+    pthread_setname_np(thread, name.substr(0, 15).c_str());
+    sched_threads.emplace_back(name, thread);
+    if (sched.policy != SCHED_OTHER) {
+        struct sched_param param = {};
+        param.sched_priority = sched.priority;
+        int err = pthread_setschedparam(thread, sched.policy, &param);
+        if (err) std::cerr << "Failed to set the scheduling policy of " << name << ": " << strerror(err) << std::endl;
+    }
+    if (sched.cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(sched.cpu, &cpus);
+        int err = pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+        if (err) std::cerr << "Failed to pin " << name << " to CPU " << sched.cpu << ": " << strerror(err) << std::endl;
+    }
+}
+
+// Fault in and lock the process's memory up front, so no page fault can stall a real-time thread
+bool lock_memory() {
+    // Keep freed memory in the heap instead of returning it, and don't mmap large allocations
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    // Serve every thread from the main heap prefaulted below rather than per-thread arenas
+    mallopt(M_ARENA_MAX, 1);
+    // Every thread's stack is locked whole once MCL_FUTURE is set, so cap it instead of
+    // locking the default 8 MB each for the port, actor, libusb and hotplug threads
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    int err = pthread_attr_setstacksize(&attr, THREAD_STACK_BYTES);
+    if (!err) err = pthread_setattr_default_np(&attr);
+    pthread_attr_destroy(&attr);
+    if (err) {
+        std::cerr << "Failed to set the thread stack size: " << strerror(err) << std::endl;
+        return false;
+    }
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        std::cerr << "Failed to lock memory: " << strerror(errno) << std::endl;
+        return false;
+    }
+    volatile uint8_t stack[PREFAULT_STACK_BYTES];
+    for (size_t i = 0; i < sizeof(stack); i += sysconf(_SC_PAGESIZE)) stack[i] = 0;
+    auto heap = std::make_unique<uint8_t[]>(PREFAULT_HEAP_BYTES);
+    for (size_t i = 0; i < PREFAULT_HEAP_BYTES; i += sysconf(_SC_PAGESIZE)) ((volatile uint8_t *)heap.get())[i] = 0;
+    return true;
+}
+
+// The policy, priority and cores each thread actually got, read back from the kernel
+void print_thread_sched(bool memory_locked) {
+    printf("Memory Locked: %s\n", memory_locked ? "yes" : "no");
+    for (auto &[name, thread] : sched_threads) {
+        int policy;
+        struct sched_param param;
+        if (pthread_getschedparam(thread, &policy, &param) != 0) continue;
+        const char *policy_name = policy == SCHED_FIFO ? "fifo" : policy == SCHED_RR ? "rr" : "other";
+        cpu_set_t cpus;
+        std::string cpu_list;
+        if (pthread_getaffinity_np(thread, sizeof(cpus), &cpus) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (!CPU_ISSET(cpu, &cpus) || (cpu > 0 && CPU_ISSET(cpu-1, &cpus))) continue;
+                int last = cpu;
+                while (last+1 < CPU_SETSIZE && CPU_ISSET(last+1, &cpus)) last++;
+                if (!cpu_list.empty()) cpu_list += ",";
+                cpu_list += std::to_string(cpu) + (last > cpu ? "-" + std::to_string(last) : "");
+            }
+        }
+        printf("  %s: policy %s, priority %d, CPUs %s\n", name.c_str(), policy_name, param.sched_priority, cpu_list.c_str());
+    }
+}
+
+// Runs the Art-Net input, every port's DMX output and USB completions on the calling thread,
+// along with the DMX commands of the device actors
+void reactor_loop(int stats_interval_s) {
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epoll_fd < 0 || timer_fd < 0) {
+        std::cerr << "Failed to create reactor: " << strerror(errno) << std::endl;
+        std::exit(1);
+    }
+    auto watch = [&](int fd, uint32_t events, uint64_t tag) {
+        struct epoll_event ev = {};
+        ev.events = events;
+        ev.data.u64 = tag;
+        return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    };
+    watch(timer_fd, EPOLLIN, REACTOR_TAG_TIMER);
+    int artnet_fd = artnet_get_sd(node);
+    if (artnet_fd < 0 || watch(artnet_fd, EPOLLIN, REACTOR_TAG_ARTNET) < 0 || watch(artnet_tx_fd, EPOLLIN, REACTOR_TAG_ARTNET_TX) < 0
+            || watch(port_event_fd, EPOLLIN, REACTOR_TAG_HOTPLUG) < 0) {
+        std::cerr << "Failed to watch the Art-Net socket" << std::endl;
+        std::exit(1);
+    }
+
+    // USB file descriptors change when a device is reopened, so they are rewatched whenever a port comes back
+    auto usb_fds = std::array<std::vector<struct pollfd>, ARTNET_MAX_PORTS>();
+    auto usb_watched = std::array<bool, ARTNET_MAX_PORTS>();
+    auto retry_ns = std::array<uint64_t, ARTNET_MAX_PORTS>(); // Busy ports to try again, 0 if not busy
+    auto dmx_queued = std::array<bool, ARTNET_MAX_PORTS>(); // The device has DMX commands ready to run
+    auto active = std::array<bool, ARTNET_MAX_PORTS>();
+    for (int port = 0; port < num_ports; port++) {
+        active[port] = ordm_dev[port].isInitialized();
+        if (active[port]) dmx_port_start(port);
+    }
+
+    uint64_t stats_ns = monotonicNs() + stats_interval_s * 1000000000ULL;
+    auto events = std::array<struct epoll_event, REACTOR_MAX_EVENTS>();
+    while (!thread_exit) {
+        for (int port = 0; port < num_ports; port++) {
+            bool initialized = active[port] && ordm_dev[port].isInitialized();
+            if (initialized == usb_watched[port]) continue;
+            auto fds = initialized ? ordm_dev[port].getPollFds() : std::vector<struct pollfd>();
+            if (!fds) continue; // The device is busy, try again next time round
+            for (auto &pfd : usb_fds[port]) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, pfd.fd, NULL);
+            usb_fds[port] = *fds;
+            // Edge triggered, an event skipped while the device is busy is handled by whoever is waiting on it
+            for (auto &pfd : usb_fds[port]) watch(pfd.fd, pfd.events | EPOLLET, REACTOR_TAG_USB + port);
+            usb_watched[port] = initialized;
+        }
+
+        // Wake a little early and spin the rest, so frames start as precisely as they do from the port threads
+        uint64_t next_ns = std::min(stats_interval_s > 0 ? stats_ns : UINT64_MAX, artsync_deadline());
+        if (stats_pending) next_ns = std::min<uint64_t>(next_ns, monotonicNs() + STATS_POLL_US * 1000ULL);
+        for (int port = 0; port < num_ports; port++) {
+            if (!active[port]) continue;
+            next_ns = std::min(next_ns, retry_ns[port] ? retry_ns[port] : dmx_port_deadline(port));
+            // Frames held for their break and breaks waiting to end are device timers
+            next_ns = std::min(next_ns, dmx_queued[port] ? 0 : ordm_dev[port].nextTimerNs());
+        }
+        int count = 0;
+        if (getClockOpenRDM()->wait_slice_ns == 0) {
+            uint64_t wake_ns = next_ns > getSpinThresholdNs() ? next_ns - getSpinThresholdNs() : 1;
+            struct itimerspec timer = {};
+            timer.it_value.tv_sec = wake_ns / 1000000000ULL;
+            timer.it_value.tv_nsec = wake_ns % 1000000000ULL;
+            if (next_ns != UINT64_MAX) timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &timer, NULL);
+            count = epoll_wait(epoll_fd, events.data(), events.size(), -1);
+        } else {
+            // The timerfd can't follow a simulated clock, wake every real time slice until it reaches next_ns
+            waitOnClock(next_ns, [&](auto timeout) {
+                struct itimerspec timer = {};
+                timer.it_value.tv_nsec = timeout.count();
+                timerfd_settime(timer_fd, 0, &timer, NULL);
+                count = epoll_wait(epoll_fd, events.data(), events.size(), -1);
+                uint64_t expirations;
+                bool expired = read(timer_fd, &expirations, sizeof(expirations)) > 0;
+                return count > (expired ? 1 : 0);
+            });
+        }
+        for (int i = 0; i < count; i++) {
+            uint64_t tag = events[i].data.u64;
+            if (tag == REACTOR_TAG_TIMER) {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) < 0) continue;
+            } else if (tag == REACTOR_TAG_ARTNET) {
+                artnet_read(node, 0);
+            } else if (tag == REACTOR_TAG_ARTNET_TX) {
+                artnet_send_queued();
+            } else if (tag == REACTOR_TAG_HOTPLUG) {
+                // Ports waiting on a device are due now, see dmx_port_deadline
+                uint64_t events;
+                if (read(port_event_fd, &events, sizeof(events)) < 0) continue;
+            } else if (tag >= REACTOR_TAG_USB) {
+                ordm_dev[tag - REACTOR_TAG_USB].handleEvents();
+            }
+        }
+        // Staged frames go out when ArtSync stops, even if no more ArtDmx arrives
+        artsync_check_timeout(monotonicNs());
+
+        for (int port = 0; port < num_ports; port++) {
+            if (!active[port]) continue;
+            auto &state = dmx_state[port];
+            uint64_t t_now = monotonicNs();
+            bool initialized = ordm_dev[port].isInitialized();
+            bool due;
+            if (retry_ns[port]) {
+                due = retry_ns[port] <= t_now;
+            } else {
+                uint64_t deadline_ns = dmx_port_deadline(port);
+                due = deadline_ns <= t_now + (initialized ? getSpinThresholdNs() : 0);
+                if (due && initialized) waitUntilNs(deadline_ns);
+            }
+            // New frames only go out straight away in change mode, continuous mode waits for the frame clock
+            bool changed = initialized && !state.continuous && dmx_mailbox[port].pending();
+            if (!due && !changed) continue;
+            bool fresh = state.continuous || dmx_mailbox[port].pending();
+            retry_ns[port] = dmx_port_service(port, fresh, false) ? 0 : monotonicNs() + REACTOR_RETRY_US * 1000ULL;
+        }
+        // Every port's due frames start their breaks before any break is ended
+        for (int port = 0; port < num_ports; port++) {
+            if (active[port]) dmx_queued[port] = ordm_dev[port].runQueued(OpenRDMPriority::DMX);
+        }
+
+        if (stats_interval_s > 0 && !stats_pending && monotonicNs() >= stats_ns) {
+            request_stats();
+            stats_ns += stats_interval_s * 1000000000ULL;
+        }
+        poll_stats();
+    }
+    close(timer_fd);
+    close(epoll_fd);
+}
+
 /*
  * called when to node configuration changes,
  * we need to save the configuration to a file
@@ -285,12 +1017,107 @@ int main(int argc, char *argv[]) {
         .default_value(std::string(""))
         .help("Set the address to listen on");
     program.add_argument("-d", "--devices")
-        .help("List of up to 4 OpenRDM FTDI device strings to connect to (empty string to skip node ports), omit this argument to list all OpenRDM devices")
+        .help("List of up to 4 OpenRDM FTDI device strings or tty paths (/dev/...) to connect to (empty string to skip node ports), omit this argument to list all OpenRDM devices")
         .nargs(1,ARTNET_MAX_PORTS);
     program.add_argument("--rdm-debug")
         .help("Output debugging information about RDM commands")
         .default_value(false)
         .implicit_value(true);
+    program.add_argument("--sync-dmx")
+        .help("Wait for each DMX frame to be transferred over USB instead of pipelining frames")
+        .default_value(false)
+        .implicit_value(true);
+    program.add_argument("--output-mode")
+        .help("DMX output mode, one value for all ports or one per port: change (send on change and refresh at --refresh-rate) or continuous (send frames at --refresh-rate)")
+        .nargs(1, ARTNET_MAX_PORTS)
+        .default_value(std::vector<std::string>{"change"});
+    program.add_argument("--refresh-rate")
+        .help("DMX refresh rate in Hz, one value for all ports or one per port: the keepalive rate for unchanged frames in change mode, the frame rate in continuous mode. 0 for as fast as the line allows (about 44Hz for 512 slots)")
+        .nargs(1, ARTNET_MAX_PORTS)
+        .default_value(std::vector<double>{DMX_REFRESH_RATE_HZ})
+        .scan<'g', double>();
+    program.add_argument("--break-us")
+        .help("Break time in microseconds, one value for all ports or one per port")
+        .nargs(1, ARTNET_MAX_PORTS)
+        .default_value(std::vector<int>{DMX_BREAK_US})
+        .scan<'i', int>();
+    program.add_argument("--mab-us")
+        .help("Mark after break time in microseconds, one value for all ports or one per port")
+        .nargs(1, ARTNET_MAX_PORTS)
+        .default_value(std::vector<int>{DMX_MAB_US})
+        .scan<'i', int>();
+    program.add_argument("--max-slots")
+        .help("Maximum DMX slots sent per frame, one value for all ports or one per port, 0 for no limit")
+        .nargs(1, ARTNET_MAX_PORTS)
+        .default_value(std::vector<int>{0})
+        .scan<'i', int>();
+    program.add_argument("--trim-slots")
+        .help("Don't send trailing 0 slots, raising the refresh rate for rigs using low channels")
+        .default_value(false)
+        .implicit_value(true);
+    program.add_argument("--min-slots")
+        .help("Minimum DMX slots sent per frame with --trim-slots, one value for all ports or one per port")
+        .nargs(1, ARTNET_MAX_PORTS)
+        .default_value(std::vector<int>{24})
+        .scan<'i', int>();
+    program.add_argument("--max-dmx-gap")
+        .help("Longest time in milliseconds RDM may hold off DMX on a port, the last frame is resent between RDM transactions to keep to it. One value for all ports or one per port, 0 for no limit")
+        .nargs(1, ARTNET_MAX_PORTS)
+        .default_value(std::vector<int>{100})
+        .scan<'i', int>();
+    program.add_argument("--stagger")
+        .help("Offset the frame clocks of ports on the same USB bus across the refresh period, so their transfers don't all hit the bus at once")
+        .default_value(false)
+        .implicit_value(true);
+    program.add_argument("--reactor")
+        .help("Run the Art-Net input and every port's DMX output on one thread, with RDM for all ports on a second thread")
+        .default_value(false)
+        .implicit_value(true);
+    program.add_argument("--always-purge")
+        .help("Purge the FTDI RX and TX buffers before every frame instead of only after RDM transactions or errors")
+        .default_value(false)
+        .implicit_value(true);
+    program.add_argument("--sched-policy")
+        .help("Scheduling policy for the network and port I/O threads: other, fifo or rr (fifo and rr need CAP_SYS_NICE)")
+        .default_value(std::string("other"));
+    program.add_argument("--port-priority")
+        .help("Real-time priority of each port's DMX and USB threads with --sched-policy fifo or rr, one value for all ports or one per port, unused with --reactor")
+        .nargs(1, ARTNET_MAX_PORTS)
+        .default_value(std::vector<int>{50})
+        .scan<'i', int>();
+    program.add_argument("--net-priority")
+        .help("Real-time priority of the thread reading Art-Net with --sched-policy fifo or rr, with --reactor it also runs DMX output")
+        .default_value(40)
+        .scan<'i', int>();
+    program.add_argument("--port-cpu")
+        .help("Core to pin each port's DMX and USB threads to, one value for all ports or one per port, -1 to not pin, unused with --reactor")
+        .nargs(1, ARTNET_MAX_PORTS)
+        .default_value(std::vector<int>{-1})
+        .scan<'i', int>();
+    program.add_argument("--net-cpu")
+        .help("Core to pin the thread reading Art-Net to, -1 to not pin")
+        .default_value(-1)
+        .scan<'i', int>();
+    program.add_argument("--lock-memory")
+        .help("Pre-fault and lock all memory at startup so real-time threads never wait on a page fault")
+        .default_value(false)
+        .implicit_value(true);
+    program.add_argument("--artsync-timeout")
+        .help("Milliseconds without ArtSync before DMX output goes back to free running, 0 to ignore ArtSync. ArtSync aligns ports in change output mode, continuous ports keep their own frame clock")
+        .default_value(ARTSYNC_TIMEOUT_MS)
+        .scan<'i', int>();
+    program.add_argument("--no-hotplug")
+        .help("Poll for lost devices every second instead of waiting for USB hotplug events")
+        .default_value(false)
+        .implicit_value(true);
+    program.add_argument("--simulated-time")
+        .help("Run on a simulated clock that skips ahead whenever every thread is waiting, for timing tests against stub devices")
+        .default_value(false)
+        .implicit_value(true);
+    program.add_argument("--stats")
+        .help("Print per port statistics every N seconds (0 to disable)")
+        .default_value(0)
+        .scan<'i', int>();
     
     try {
         program.parse_args(argc, argv);
@@ -304,6 +1131,57 @@ int main(int argc, char *argv[]) {
     rdm_enabled = program.get<bool>("--rdm");
     incremental_scan = program.get<bool>("--incremental-scan");
     bool rdm_debug = program.get<bool>("--rdm-debug");
+    int stats_interval_s = program.get<int>("--stats");
+
+    struct openrdm_options options;
+    defaultOpenRDMOptions(&options);
+    options.async = !program.get<bool>("--sync-dmx");
+    options.always_purge = program.get<bool>("--always-purge");
+    auto output_modes = get_port_values<std::string>(program, "--output-mode");
+    dmx_refresh_rate = get_port_values<double>(program, "--refresh-rate");
+    for (size_t i = 0; i < ARTNET_MAX_PORTS; i++) {
+        if (output_modes[i] == "change") {
+            dmx_output_mode[i] = DMXOutputMode::Change;
+        } else if (output_modes[i] == "continuous") {
+            dmx_output_mode[i] = DMXOutputMode::Continuous;
+        } else {
+            std::cerr << "Invalid output mode: " << output_modes[i] << ", must be change or continuous" << std::endl;
+            std::exit(1);
+        }
+        if (dmx_refresh_rate[i] < 0) {
+            std::cerr << "Invalid refresh rate: " << dmx_refresh_rate[i] << std::endl;
+            std::exit(1);
+        }
+    }
+    auto break_us = get_port_values<int>(program, "--break-us");
+    auto mab_us = get_port_values<int>(program, "--mab-us");
+    auto max_slots = get_port_values<int>(program, "--max-slots");
+    auto min_slots = get_port_values<int>(program, "--min-slots");
+    auto max_dmx_gap_ms = get_port_values<int>(program, "--max-dmx-gap");
+    options.trim_slots = program.get<bool>("--trim-slots");
+    dmx_stagger = program.get<bool>("--stagger");
+    bool reactor = program.get<bool>("--reactor");
+    artsync_timeout_ms = std::max(0, program.get<int>("--artsync-timeout"));
+
+    auto sched_policy = program.get<std::string>("--sched-policy");
+    int policy = SCHED_OTHER;
+    if (sched_policy == "fifo") {
+        policy = SCHED_FIFO;
+    } else if (sched_policy == "rr") {
+        policy = SCHED_RR;
+    } else if (sched_policy != "other") {
+        std::cerr << "Invalid scheduling policy: " << sched_policy << ", must be other, fifo or rr" << std::endl;
+        std::exit(1);
+    }
+    auto port_priority = get_port_values<int>(program, "--port-priority");
+    auto port_cpu = get_port_values<int>(program, "--port-cpu");
+    auto clamp_priority = [policy](int priority) {
+        return policy == SCHED_OTHER ? 0 : std::clamp(priority, sched_get_priority_min(policy), sched_get_priority_max(policy));
+    };
+    auto net_sched = ThreadSched{policy, clamp_priority(program.get<int>("--net-priority")), program.get<int>("--net-cpu")};
+    bool sched_report = verbose || policy != SCHED_OTHER || net_sched.cpu >= 0 || program.is_used("--port-cpu")
+        || program.get<bool>("--lock-memory");
+    bool memory_locked = program.get<bool>("--lock-memory") && lock_memory();
 
     auto dev_strings = program.get<std::vector<std::string>>("--devices");
     for (size_t i = 0; i < ARTNET_MAX_PORTS && i < dev_strings.size(); i++) {
@@ -318,12 +1196,34 @@ int main(int argc, char *argv[]) {
 
     bool device_connected = false;
 
+    if (program.get<bool>("--simulated-time")) setClockOpenRDM(&openrdm_simulated_clock);
+    attachThreadOpenRDM();
+    port_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!program.get<bool>("--no-hotplug")) {
+        int ret = watchHotplugOpenRDM(verbose, usb_hotplug, NULL);
+        hotplug_active = ret == 0;
+        if (verbose && !hotplug_active) printf("USB hotplug unavailable (%d), polling lost devices every %u ms\n",
+            ret, THREAD_REINIT_TIMEOUT_MS);
+    }
+    calibrateTimingOpenRDM(verbose);
+
+    // In reactor mode the devices are run by the reactor and the shared RDM thread, which this wakes
+    auto shared_rdm_sema = std::make_shared<std::counting_semaphore<SEMA_MAX>>(0);
+    auto wake_rdm = [shared_rdm_sema] { if (!rdm_actor_wake.exchange(true)) shared_rdm_sema->release(); };
+
     // Initialize openrdm devices
     if (verbose) std::cout << "Initialising OpenRDM Devices..." << std::endl;
     for (size_t i = 0; i < ARTNET_MAX_PORTS && i < dev_strings.size(); i++) {
         // Skip 0 length device strings
         if (dev_strings.at(i).size() == 0) continue;
         ordm_dev[i] = OpenRDMDevice(dev_strings.at(i), verbose, rdm_enabled, rdm_debug);
+        if (reactor) ordm_dev[i].drive(wake_rdm);
+        options.break_us = std::max(0, break_us[i]);
+        options.mab_us = std::max(0, mab_us[i]);
+        options.max_slots = std::clamp(max_slots[i], 0, DMX_MAX_LENGTH);
+        options.min_slots = std::clamp(min_slots[i], 0, DMX_MAX_LENGTH);
+        options.max_dmx_gap_us = std::max(0, max_dmx_gap_ms[i]) * 1000;
+        ordm_dev[i].setOptions(options);
         device_connected |= ordm_dev[i].init();
         num_ports++;
     }
@@ -335,22 +1235,63 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
+    if (dmx_stagger) {
+        // Spread the ports on each bus evenly across their refresh period
+        auto bus = std::array<int, ARTNET_MAX_PORTS>();
+        for (int i = 0; i < num_ports; i++) bus[i] = ordm_dev[i].isInitialized() ? ordm_dev[i].getBusNumber() : -1;
+        for (int i = 0; i < num_ports; i++) {
+            if (bus[i] < 0) continue;
+            int index = 0, count = 0;
+            for (int j = 0; j < num_ports; j++) {
+                if (bus[j] != bus[i]) continue;
+                if (j < i) index++;
+                count++;
+            }
+            dmx_phase[i] = (double)index / count;
+            if (verbose) printf("Port %d (%s): USB bus %d, phase %d/%d\n", i+1,
+                ordm_dev[i].getDescription().c_str(), bus[i], index, count);
+        }
+    }
+    dmx_epoch_ns = monotonicNs();
+
     if (rdm_enabled && verbose) {
         std::cout << "RDM Enabled" << std::endl;
     }
 
+    artnet_tx_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (artnet_tx_fd < 0) {
+        std::cerr << "Failed to create the Art-Net send queue: " << strerror(errno) << std::endl;
+        std::exit(1);
+    }
+
     for (int i = 0; i < num_ports; i++) {
-        dmx_thread_sema[i] = std::make_shared<std::counting_semaphore<SEMA_MAX>>(0);
-        rdm_thread_sema[i] = std::make_shared<std::counting_semaphore<SEMA_MAX>>(0);
+        rdm_thread_sema[i] = reactor ? shared_rdm_sema : std::make_shared<std::counting_semaphore<SEMA_MAX>>(0);
     }
        
 
     auto ordm_dmx_threads = std::vector<std::thread>();
     auto ordm_rdm_threads = std::vector<std::thread>();
+    if (reactor) {
+        ordm_rdm_threads.push_back(std::thread(rdm_shared_thread));
+    } else {
+        for (int i = 0; i < num_ports; i++) {
+            ordm_dmx_threads.push_back(std::thread(dmx_thread, i));
+            ordm_rdm_threads.push_back(std::thread(rdm_thread, i));
+        }
+    }
+
+    set_thread_sched(pthread_self(), reactor ? "reactor" : "artnet", net_sched);
+    if (reactor) set_thread_sched(ordm_rdm_threads[0].native_handle(), "rdm", ThreadSched());
     for (int i = 0; i < num_ports; i++) {
-        ordm_dmx_threads.push_back(std::thread(dmx_thread, i));
-        ordm_rdm_threads.push_back(std::thread(rdm_thread, i));
+        if (!ordm_dev[i].isInitialized()) continue;
+        auto port_sched = ThreadSched{policy, clamp_priority(port_priority[i]), port_cpu[i]};
+        auto port_name = std::to_string(i+1);
+        if (reactor) continue;
+        set_thread_sched(ordm_dev[i].getThreadHandle(), "usb-port" + port_name, port_sched);
+        set_thread_sched(ordm_dmx_threads[i].native_handle(), "dmx-port" + port_name, port_sched);
+        set_thread_sched(ordm_rdm_threads[i].native_handle(), "rdm-port" + port_name, ThreadSched{SCHED_OTHER, 0, port_cpu[i]});
     }
+    if (sched_report) print_thread_sched(memory_locked);
     
     char *ip_addr = NULL;
     auto ip_addr_string = program.get<std::string>("--address");
@@ -371,6 +1312,7 @@ int main(int argc, char *argv[]) {
     // we want to be notified when the node config changes
     artnet_set_program_handler(node, program_handler, NULL);
     artnet_set_dmx_handler(node, dmx_handler, NULL);
+    artnet_set_handler(node, ARTNET_RECV_HANDLER, artnet_recv_handler, NULL);
 
     // set the universe address of the first port
     for (int i = 0; i < num_ports; i++)
@@ -383,9 +1325,35 @@ int main(int argc, char *argv[]) {
     }
     artnet_start(node);
     
+    if (reactor) reactor_loop(stats_interval_s);
+
+    uint64_t stats_ns = monotonicNs() + stats_interval_s * 1000000000ULL;
     // loop until control C
-    while(1) {
-        artnet_read(node, 1);
+    auto poll_fds = std::array<struct pollfd, 2>();
+    poll_fds[0] = {artnet_get_sd(node), POLLIN, 0};
+    poll_fds[1] = {artnet_tx_fd, POLLIN, 0};
+    while(!reactor) {
+        // Wake for either direction, so queued responses don't wait for the next packet in
+        uint64_t wake_ns = monotonicNs() + 1000000000ULL;
+        if (stats_interval_s > 0) wake_ns = std::min(wake_ns, stats_ns);
+        wake_ns = std::min(wake_ns, artsync_deadline());
+        if (stats_pending) wake_ns = std::min<uint64_t>(wake_ns, monotonicNs() + STATS_POLL_US * 1000ULL);
+        bool ready = waitOnClock(wake_ns, [&](auto timeout) {
+            struct timespec ts = { (time_t)(timeout.count() / 1000000000), (long)(timeout.count() % 1000000000) };
+            return ppoll(poll_fds.data(), poll_fds.size(), &ts, NULL) > 0;
+        });
+        if (ready) {
+            if (poll_fds[0].revents & POLLIN) artnet_read(node, 0);
+            if (poll_fds[1].revents & POLLIN) artnet_send_queued();
+        }
+        // Staged frames go out when ArtSync stops, even if no more ArtDmx arrives
+        artsync_check_timeout(monotonicNs());
+
+        if (stats_interval_s > 0 && !stats_pending && monotonicNs() >= stats_ns) {
+            request_stats();
+            stats_ns += stats_interval_s * 1000000000ULL;
+        }
+        poll_stats();
     }
     // never reached
     artnet_destroy(node);
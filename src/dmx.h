@@ -6,7 +6,12 @@
 // https://erg.abdn.ac.uk/users/gorry/eg3576/start-codes.html
 #define DMX_START_CODE 0
 #define RDM_START_CODE 0xcc
+#define RDM_SUB_START_CODE 0x01
 
 #define DMX_MAX_LENGTH 512
+#define DMX_SLOT_TIME_US 44 // 11 bits at 250kBaud
+#define DMX_BREAK_US 92 // Minimum transmitted break
+#define DMX_MAB_US 12 // Minimum transmitted mark after break
+#define DMX_MIN_PACKET_US 1204 // Minimum time between breaks
 
 #endif // __DMX_H__
\ No newline at end of file
@@ -0,0 +1,39 @@
+#ifndef __DMX_COMPARE_HPP__
+#define __DMX_COMPARE_HPP__
+
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Compares DMX data 16 bytes at a time, a full universe is 32 vector compares
+inline bool dmxDataEqual(const uint8_t *a, const uint8_t *b, size_t length) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= length; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a+i));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b+i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xffff) return false;
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t diff = veorq_u8(vld1q_u8(a+i), vld1q_u8(b+i));
+#if defined(__aarch64__)
+        if (vmaxvq_u8(diff) != 0) return false;
+#else
+        uint8x8_t folded = vorr_u8(vget_low_u8(diff), vget_high_u8(diff));
+        if (vget_lane_u64(vreinterpret_u64_u8(folded), 0) != 0) return false;
+#endif
+    }
+#endif
+    for (; i < length; i++) {
+        if (a[i] != b[i]) return false;
+    }
+    return true;
+}
+
+#endif // __DMX_COMPARE_HPP__
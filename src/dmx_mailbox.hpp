@@ -0,0 +1,63 @@
+#ifndef __DMX_MAILBOX_HPP__
+#define __DMX_MAILBOX_HPP__
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <semaphore>
+#include <cstdint>
+
+#include "dmx.h"
+
+struct DMXFrame {
+    int length = 1; // Including start code
+    std::array<uint8_t, DMX_MAX_LENGTH+1> data = { DMX_START_CODE }; // data[0] is the start code
+    uint64_t start_ns = 0; // Earliest time to start the frame's break, 0 for as soon as possible
+};
+
+// Latest wins triple buffer between the network thread (single writer) and a port's DMX thread (single reader)
+// The writer fills back() and publishes it, replacing any frame the reader hasn't picked up yet,
+// the reader owns front() until its next acquire() so it can be handed straight to the transport
+class DMXMailbox {
+    public:
+        DMXFrame &back() { return frames[back_index]; }
+        DMXFrame &front() { return frames[front_index]; }
+
+        void publish() {
+            uint8_t prev = middle.exchange(back_index | FRESH, std::memory_order_acq_rel);
+            back_index = prev & INDEX_MASK;
+            // Only wake the reader on the edge, a burst of frames is a single wakeup
+            if (!(prev & FRESH)) wakeup.release();
+        }
+
+        // Swap in the newest frame if there is one, front() must no longer be in use
+        bool acquire() {
+            if (!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+            uint8_t prev = middle.exchange(front_index, std::memory_order_acq_rel);
+            front_index = prev & INDEX_MASK;
+            // Consume the wakeup for this frame if we got here without waiting for it
+            wakeup.try_acquire();
+            return true;
+        }
+
+        // A frame has been published since the last acquire()
+        bool pending() const { return middle.load(std::memory_order_relaxed) & FRESH; }
+
+        // Returns true if a frame may have been published, false on timeout
+        template <class Clock, class Duration>
+        bool wait_until(const std::chrono::time_point<Clock, Duration> &t) {
+            if (middle.load(std::memory_order_relaxed) & FRESH) return true;
+            return wakeup.try_acquire_until(t);
+        }
+
+    private:
+        static constexpr uint8_t INDEX_MASK = 0x3;
+        static constexpr uint8_t FRESH = 0x4;
+        std::array<DMXFrame, 3> frames;
+        uint8_t back_index = 0;
+        uint8_t front_index = 1;
+        std::atomic<uint8_t> middle = 2;
+        std::counting_semaphore<> wakeup{0};
+};
+
+#endif // __DMX_MAILBOX_HPP__
@@ -0,0 +1,61 @@
+#ifndef __MPSC_QUEUE_HPP__
+#define __MPSC_QUEUE_HPP__
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Bounded lock-free FIFO that any number of threads can push to and a single thread pops from.
+// Each cell carries a sequence number saying whether it is free for the push at that position
+// or holds the item for the pop at that position, so producers only contend on claiming a cell
+template <typename T, size_t Capacity>
+class MPSCQueue {
+    static_assert(Capacity > 0 && (Capacity & (Capacity-1)) == 0, "Capacity must be a power of 2");
+
+    public:
+        MPSCQueue() {
+            for (size_t i = 0; i < Capacity; i++) cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        // Any thread, returns false if the queue is full
+        bool push(const T &item) {
+            size_t pos = tail_index.load(std::memory_order_relaxed);
+            while (true) {
+                auto &cell = cells[pos & INDEX_MASK];
+                intptr_t diff = (intptr_t)cell.sequence.load(std::memory_order_acquire) - (intptr_t)pos;
+                if (diff < 0) return false; // The consumer hasn't freed this cell from the last lap
+                if (diff > 0) {
+                    // Another producer claimed it first
+                    pos = tail_index.load(std::memory_order_relaxed);
+                } else if (tail_index.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) {
+                    cell.item = item;
+                    cell.sequence.store(pos+1, std::memory_order_release);
+                    return true;
+                }
+            }
+        }
+
+        // Consumer only, returns false if the queue is empty or the next item is still being pushed
+        bool pop(T &item) {
+            auto &cell = cells[head_index & INDEX_MASK];
+            if (cell.sequence.load(std::memory_order_acquire) != head_index+1) return false;
+            item = cell.item;
+            cell.sequence.store(head_index+Capacity, std::memory_order_release);
+            head_index++;
+            return true;
+        }
+
+    private:
+        static constexpr size_t INDEX_MASK = Capacity-1;
+        struct Cell {
+            std::atomic<size_t> sequence;
+            T item;
+        };
+        std::array<Cell, Capacity> cells;
+        // On separate cache lines so producers claiming cells don't bounce the consumer's index
+        alignas(64) std::atomic<size_t> tail_index = 0;
+        alignas(64) size_t head_index = 0;
+};
+
+#endif // __MPSC_QUEUE_HPP__
@@ -1,9 +1,78 @@
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "dmx.h"
 #include "openrdm.h"
+#include "openrdm_timing.h"
+#include "openrdm_transport.h"
+
+static uint64_t lineTimeNs(int size) {
+    return (uint64_t)size * DMX_SLOT_TIME_US * 1000;
+}
+
+void defaultOpenRDMOptions(struct openrdm_options *options) {
+    memset(options, 0, sizeof(*options));
+    options->async = 1;
+    options->break_us = DMX_BREAK_US;
+    options->mab_us = DMX_MAB_US;
+}
+
+void clearOpenRDMContext(struct openrdm_context *ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->tty_fd = -1;
+    defaultOpenRDMOptions(&ctx->options);
+}
+
+static int capSlotsOpenRDM(struct openrdm_context *ctx, int size) {
+    int slots = size - 1;
+    if (ctx->options.max_slots > 0 && slots > (int)ctx->options.max_slots) slots = ctx->options.max_slots;
+    return slots;
+}
+
+static int trimSlotsOpenRDM(struct openrdm_context *ctx, const unsigned char *data, int slots) {
+    int min_slots = slots < (int)ctx->options.min_slots ? slots : (int)ctx->options.min_slots;
+    while (slots > min_slots && data[slots] == 0) slots--;
+    return slots;
+}
+
+// Size of a DMX frame (including start code) after applying the slot cap and trimming trailing 0 slots,
+// slots that were recently sent non zero are kept so fixtures see them drop to 0
+int dmxSizeOpenRDM(struct openrdm_context *ctx, const unsigned char *data, int size) {
+    int slots = capSlotsOpenRDM(ctx, size);
+    if (!ctx->options.trim_slots) return slots + 1;
+    int trimmed = trimSlotsOpenRDM(ctx, data, slots);
+    if (trimmed < ctx->trim_extent && ctx->trim_hold > 0) trimmed = ctx->trim_extent;
+    return (trimmed < slots ? trimmed : slots) + 1;
+}
+
+// Track the trimmed extent of each frame, shrinking it only once it has been held for TRIM_HOLD_FRAMES
+static void updateTrimOpenRDM(struct openrdm_context *ctx, const unsigned char *data, int size) {
+    int slots = trimSlotsOpenRDM(ctx, data, capSlotsOpenRDM(ctx, size));
+    if (slots >= ctx->trim_extent) {
+        ctx->trim_extent = slots;
+        ctx->trim_hold = TRIM_HOLD_FRAMES;
+    } else if (ctx->trim_hold > 0) {
+        ctx->trim_hold--;
+    } else {
+        ctx->trim_extent = slots;
+    }
+}
+
+// Time a DMX frame takes to send, using the measured break overhead once we have one,
+// only call from the thread sending DMX
+uint64_t frameTimeNsOpenRDM(struct openrdm_context *ctx, const unsigned char *data, int size) {
+    uint64_t break_ns = (ctx->options.break_us + ctx->options.mab_us) * 1000ULL;
+    if (ctx->dmx_break_overhead_ns > break_ns) break_ns = ctx->dmx_break_overhead_ns;
+    uint64_t frame_ns = break_ns + lineTimeNs(dmxSizeOpenRDM(ctx, data, size));
+    return frame_ns > DMX_MIN_PACKET_US * 1000ULL ? frame_ns : DMX_MIN_PACKET_US * 1000ULL;
+}
 
 int findOpenRDMDevices(int verbose) {
     if (verbose) printf("Finding OpenRDM Devices...\n");
@@ -56,111 +125,492 @@ int findOpenRDMDevices(int verbose) {
     return devices;
 }
 
-void FT_SetTimeouts(struct ftdi_context *ftdi, int read_timeout, int write_timeout) {
-    ftdi->usb_read_timeout = read_timeout;
-    ftdi->usb_write_timeout = write_timeout;
+#ifdef HAVE_LIBFTDI1
+struct hotplug_watch {
+    void (*callback)(int arrived, void *user);
+    void *user;
+    int verbose;
+};
+
+static int LIBUSB_CALL hotplugEventOpenRDM(libusb_context *usb, libusb_device *dev, libusb_hotplug_event event, void *user) {
+    struct hotplug_watch *watch = (struct hotplug_watch *)user;
+    int arrived = event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED;
+    if (watch->verbose) printf("OpenRDM device %s on USB bus %d\n", arrived ? "arrived" : "left", libusb_get_bus_number(dev));
+    watch->callback(arrived, watch->user);
+    return 0; // Stay registered
 }
 
-void FT_SetBreakOn(struct ftdi_context *ftdi) {
-    int ret = ftdi_set_line_property2(ftdi, BITS_8, STOP_BIT_2, NONE, BREAK_ON);
-    if (ret != 0) printf("Break On Failed: %d\n", ret);
+static void *hotplugThreadOpenRDM(void *arg) {
+    libusb_context *usb = (libusb_context *)arg;
+    while (1) libusb_handle_events_completed(usb, NULL);
+    return NULL;
+}
+#endif
+
+// Calls callback from its own thread whenever a device with the OpenRDM VID/PID is plugged in (arrived = 1)
+// or unplugged (arrived = 0). Returns 0, or a negative error if the platform has no USB hotplug events
+int watchHotplugOpenRDM(int verbose, void (*callback)(int arrived, void *user), void *user) {
+#ifdef HAVE_LIBFTDI1
+    if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) return LIBUSB_ERROR_NOT_SUPPORTED;
+    libusb_context *usb;
+    int ret = libusb_init(&usb);
+    if (ret < 0) return ret;
+    static struct hotplug_watch watch;
+    watch.callback = callback;
+    watch.user = user;
+    watch.verbose = verbose;
+    ret = libusb_hotplug_register_callback(usb,
+        LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT, 0,
+        OPENRDM_VID, OPENRDM_PID, LIBUSB_HOTPLUG_MATCH_ANY, hotplugEventOpenRDM, &watch, NULL);
+    if (ret < 0) {
+        libusb_exit(usb);
+        return ret;
+    }
+    pthread_t thread;
+    ret = pthread_create(&thread, NULL, hotplugThreadOpenRDM, usb);
+    if (ret != 0) {
+        libusb_exit(usb);
+        return -ret;
+    }
+    pthread_detach(thread);
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+// Line control wrappers, these are control transfers on USB devices so they're counted for the stats
+static void setBreakOpenRDM(struct openrdm_context *ctx, int on) {
+    ctx->stats.control_transfers++;
+    int ret = ctx->transport->set_break(ctx, on);
+    if (ret != 0) printf("Break %s Failed: %d\n", on ? "On" : "Off", ret);
+}
+
+static void purgeRxOpenRDM(struct openrdm_context *ctx) {
+    ctx->stats.control_transfers++;
+    ctx->transport->purge_rx(ctx);
+}
+
+static void purgeTxOpenRDM(struct openrdm_context *ctx) {
+    ctx->stats.control_transfers++;
+    ctx->transport->purge_tx(ctx);
+}
+
+// Only purge the buffers a previous transaction could have left data in,
+// the DMX path never reads so it can leave received data for the next RDM transaction
+static void purgeLineOpenRDM(struct openrdm_context *ctx, int is_rdm) {
+    if (ctx->options.always_purge || (is_rdm && ctx->rx_dirty)) {
+        purgeRxOpenRDM(ctx);
+        ctx->rx_dirty = 0;
+        ctx->stats.purges++;
+    } else {
+        ctx->stats.purges_skipped++;
+    }
+    if (ctx->options.always_purge || ctx->tx_dirty) {
+        purgeTxOpenRDM(ctx);
+        ctx->tx_dirty = 0;
+        ctx->stats.purges++;
+    } else {
+        ctx->stats.purges_skipped++;
+    }
+}
+
+static int writeRawOpenRDM(struct openrdm_context *ctx, unsigned char *data, int size) {
+    ctx->stats.bulk_transfers++;
+    int ret = ctx->transport->write(ctx, data, size);
+    if (ret != size) ctx->tx_dirty = 1; // Part of the write may still be queued
+    return ret;
+}
+
+// Blocking write, returns once the device has taken the data
+static int transmitOpenRDM(struct openrdm_context *ctx, unsigned char *data, int size) {
+    ctx->tx_complete_ns = monotonicNs() + lineTimeNs(size);
+    return writeRawOpenRDM(ctx, data, size);
+}
+
+// Start a write without waiting for it to complete, data must stay valid until waitTransmitOpenRDM
+static int submitOpenRDM(struct openrdm_context *ctx, unsigned char *data, int size) {
+    if (!ctx->transport->submit) return transmitOpenRDM(ctx, data, size);
+    ctx->stats.bulk_transfers++;
+    ctx->tx_complete_ns = monotonicNs() + lineTimeNs(size);
+    int ret = ctx->transport->submit(ctx, data, size);
+    if (ret != size) ctx->tx_dirty = 1;
+    return ret;
+}
+
+// Wait for the in flight frame to complete and leave the line
+static int waitTransmitOpenRDM(struct openrdm_context *ctx) {
+    int ret = ctx->transport->wait(ctx);
+    if (ret < 0) ctx->tx_dirty = 1;
+    // The device FIFO still holds the end of the frame, so don't break over it
+    waitUntilNs(ctx->tx_complete_ns);
+    return ret;
+}
+
+// The device applies a control transfer somewhere between us starting it and it completing,
+// so line changes are timed from the midpoint of each transfer, and the break off transfer is
+// started early by half its measured latency. Returns when the break went on
+static uint64_t breakOnOpenRDM(struct openrdm_context *ctx) {
+    uint64_t t_start = monotonicNs();
+    setBreakOpenRDM(ctx, 1);
+    return (t_start + monotonicNs()) / 2;
+}
+
+static uint64_t breakEndNsOpenRDM(struct openrdm_context *ctx, uint64_t t_break) {
+    return t_break + ctx->options.break_us * 1000ULL - ctx->control_half_latency_ns;
+}
+
+// Ends the break that went on at t_break and waits out the mark after break, the data write must follow immediately
+static void breakOffOpenRDM(struct openrdm_context *ctx, uint64_t t_break) {
+    waitUntilNs(breakEndNsOpenRDM(ctx, t_break));
+    uint64_t t_start = monotonicNs();
+    setBreakOpenRDM(ctx, 0);
+    uint64_t t_end = monotonicNs();
+    uint64_t t_mab = (t_start + t_end) / 2;
+    // Smooth the latency estimate so one slow transfer doesn't shorten the next break
+    ctx->control_half_latency_ns = (7 * ctx->control_half_latency_ns + (t_end - t_start) / 2) / 8;
+    if (ctx->control_half_latency_ns > ctx->options.break_us * 1000ULL)
+        ctx->control_half_latency_ns = ctx->options.break_us * 1000ULL;
+    recordInterval(&ctx->stats.break_time, t_mab - t_break);
+    waitUntilNs(t_mab + ctx->options.mab_us * 1000ULL);
+    recordInterval(&ctx->stats.mab_time, monotonicNs() - t_mab);
+}
+
+static void sendBreakOpenRDM(struct openrdm_context *ctx) {
+    breakOffOpenRDM(ctx, breakOnOpenRDM(ctx));
+}
+
+// Reads an RDM response a piece at a time, asking for exactly the bytes its message length says are
+// left so the read ends with the checksum instead of waiting for the line to go quiet
+static int readResponseOpenRDM(struct openrdm_context *ctx, unsigned char *data, int size) {
+    uint64_t deadline_ns = monotonicNs() + RDM_READ_TIMEOUT_US * 1000ULL;
+    int received = 0;
+    int expected = 3; // Start code, sub start code and message length
+    while (received < expected) {
+        int ret = ctx->transport->read(ctx, data + received, expected - received, deadline_ns);
+        if (ret < 0) return ret;
+        if (ret == 0) break;
+        received += ret;
+        if (expected == 3 && received >= 3) {
+            if (data[0] != RDM_START_CODE || data[1] != RDM_SUB_START_CODE) {
+                // Not a response we can parse, take whatever else arrives
+                ret = ctx->transport->read(ctx, data + received, size - received, deadline_ns);
+                return ret < 0 ? ret : received + ret;
+            }
+            // The message length is the slot number of the checksum high byte
+            expected = data[2] + 2;
+            if (expected > size) expected = size;
+        }
+    }
+    return received;
 }
 
-void FT_SetBreakOff(struct ftdi_context *ftdi) {
-    int ret = ftdi_set_line_property2(ftdi, BITS_8, STOP_BIT_2, NONE, BREAK_OFF);
-    if (ret != 0) printf("Break Off Failed: %d\n", ret);
+// Discovery responses have no break or length, so reads end once a delimiter and the encoded
+// bytes after it are in, or when no response has started in the E1.20 window after the request
+static int readDiscoveryOpenRDM(struct openrdm_context *ctx, unsigned char *data, int size) {
+    uint64_t deadline_ns = ctx->tx_complete_ns + (RDM_DUB_WINDOW_US + RDM_READ_LATENCY_US) * 1000ULL;
+    int received = 0;
+    int expected = 1 + RDM_DUB_ENCODED_LENGTH; // The shortest response, without a preamble
+    while (received < expected) {
+        int ret = ctx->transport->read(ctx, data + received, expected - received, deadline_ns);
+        if (ret < 0) return ret;
+        if (ret == 0) break;
+        if (received == 0) {
+            // Started, allow for the longest response to finish
+            deadline_ns = monotonicNs() + ((RDM_DUB_PREAMBLE_MAX + 1 + RDM_DUB_ENCODED_LENGTH)
+                * DMX_SLOT_TIME_US + RDM_READ_LATENCY_US) * 1000ULL;
+        }
+        received += ret;
+        int i = 0;
+        while (i < received && i < RDM_DUB_PREAMBLE_MAX && data[i] == 0xFE) i++;
+        if (i < received && data[i] != 0xAA) {
+            // Colliding responses, take whatever else arrives so the branch is split
+            expected = size;
+        } else {
+            expected = i + 1 + RDM_DUB_ENCODED_LENGTH;
+        }
+        if (expected > size) expected = size;
+    }
+    return received;
 }
 
-void resetUsbAndInitOpenRDM(int verbose, struct ftdi_context *ftdi) {
-    ftdi_usb_reset(ftdi);
-    ftdi_set_baudrate(ftdi, BAUDRATE);
-    ftdi_set_line_property(ftdi, BITS_8, STOP_BIT_2, NONE);
-    ftdi_setflowctrl(ftdi, SIO_DISABLE_FLOW_CTRL);
-    ftdi_usb_purge_rx_buffer(ftdi);
-    ftdi_usb_purge_tx_buffer(ftdi);
-    FT_SetTimeouts(ftdi, 20, 50);
+const struct openrdm_transport *selectTransportOpenRDM(const char *description) {
+    if (strncmp(description, OPENRDM_STUB_PREFIX, strlen(OPENRDM_STUB_PREFIX)) == 0) return &openrdm_stub_transport;
+    if (strncmp(description, OPENRDM_TTY_PREFIX, strlen(OPENRDM_TTY_PREFIX)) == 0) return &openrdm_tty_transport;
+    return &openrdm_ftdi_transport;
 }
 
-int initOpenRDM(int verbose, struct ftdi_context *ftdi, const char *description) {
+int initOpenRDM(int verbose, struct openrdm_context *ctx, const char *description) {
     // if (verbose) printf("Initialising OpenRDM Device...\n");
+    ctx->transport = selectTransportOpenRDM(description);
+    ctx->tx_complete_ns = 0;
+    ctx->reinit_pending = 0;
+    // Resetting the line purges both buffers
+    ctx->rx_dirty = 0;
+    ctx->tx_dirty = 0;
 
-    int ret = ftdi_init(ftdi);
+    int ret = ctx->transport->open(verbose, ctx, description);
     if (ret != 0) {
-        fprintf(stderr, "FTDI ERROR %d: %s\n", ret, ftdi->error_str);
         if (verbose) printf("Failed to initialise OpenRDM Device: %s\n", description);
         return 0;
     }
+    ctx->opened = 1;
 
-    ret = ftdi_usb_open_string(ftdi, description);
+    ret = ctx->transport->reset(ctx);
     if (ret != 0) {
-        fprintf(stderr, "FTDI ERROR %d: %s\n", ret, ftdi->error_str);
+        fprintf(stderr, "%s ERROR %d: %s\n", ctx->transport->name, ret, ctx->transport->error_str(ctx));
+        deinitOpenRDM(verbose, ctx);
         if (verbose) printf("Failed to initialise OpenRDM Device: %s\n", description);
         return 0;
     }
-    
-    resetUsbAndInitOpenRDM(verbose, ftdi);
 
-    if (verbose) printf("Initialised OpenRDM Device: %s\n", description);
+    if (verbose) printf("Initialised %s OpenRDM Device: %s\n", ctx->transport->name, description);
     return 1;
 }
 
-void deinitOpenRDM(int verbose, struct ftdi_context *ftdi) {
-    // Check we have usb device handle before we try to close it
-    if (ftdi->usb_dev) ftdi_usb_close(ftdi);
-    ftdi_deinit(ftdi);
+void deinitOpenRDM(int verbose, struct openrdm_context *ctx) {
+    if (!ctx->transport) return;
+    // A started frame is dropped, opening the device resets the line
+    ctx->dmx_data = NULL;
+    if (ctx->opened) {
+        // Don't free the device under an in flight transfer
+        waitTransmitOpenRDM(ctx);
+        ctx->opened = 0;
+    }
+    ctx->transport->close(ctx);
 }
 
-void reinitOpenRDM(int verbose, struct ftdi_context *ftdi, const char *description) {
-    if (!ftdi->usb_dev) return;
-    ftdi_usb_close(ftdi);
-    initOpenRDM(verbose, ftdi, description);
+int busNumberOpenRDM(struct openrdm_context *ctx) {
+    if (!ctx->opened || !ctx->transport->bus_number) return -1;
+    return ctx->transport->bus_number(ctx);
 }
 
-int writeRDMOpenRDM(int verbose, struct ftdi_context *ftdi, unsigned char *data, int size, int is_discover, int has_rx, unsigned char *rx_data, const char *description) {
-    ftdi_usb_purge_rx_buffer(ftdi);
-    ftdi_usb_purge_tx_buffer(ftdi);
-    FT_SetBreakOn(ftdi);
-    usleep(92); // Wait for break time of 92us
-    FT_SetBreakOff(ftdi);
+int pollFdsOpenRDM(struct openrdm_context *ctx, struct pollfd *fds, int max) {
+    if (!ctx->opened || !ctx->transport->poll_fds) return 0;
+    return ctx->transport->poll_fds(ctx, fds, max);
+}
+
+void handleEventsOpenRDM(struct openrdm_context *ctx) {
+    if (!ctx->opened || !ctx->transport->handle_events) return;
+    ctx->transport->handle_events(ctx);
+}
+
+static void reinitOpenRDM(int verbose, struct openrdm_context *ctx, const char *description) {
+    if (!ctx->opened) return;
+    deinitOpenRDM(verbose, ctx);
+    initOpenRDM(verbose, ctx, description);
+}
+
+// Reopens the device after a transfer failed in a way that needs it, straight away
+// unless defer_reinit is set, when reinitPendingOpenRDM does it later
+static void transferFailedOpenRDM(int verbose, struct openrdm_context *ctx, int ret, const char *description) {
+    // libusb: -110: usb bulk write failed
+    // libusb: -666: USB device unavailable
+    if (ret != -110 && ret != -666) return;
+    if (ctx->defer_reinit) {
+        ctx->reinit_pending = 1;
+    } else {
+        reinitOpenRDM(verbose, ctx, description);
+    }
+}
+
+// Reopening takes a few control transfers, so a caller that can't block for them defers it to here
+void reinitPendingOpenRDM(int verbose, struct openrdm_context *ctx, const char *description) {
+    if (!ctx->reinit_pending) return;
+    ctx->reinit_pending = 0;
+    reinitOpenRDM(verbose, ctx, description);
+}
+
+// Longest the transaction about to be sent can take: getting the request onto the line, then the
+// wait for a response to start and the longest response, or the discovery window
+static uint64_t transactionBoundNs(struct openrdm_context *ctx, int size, int is_discover, unsigned int timeout_us) {
+    uint64_t bound_ns = (ctx->rdm_setup_ns ? ctx->rdm_setup_ns : RDM_SETUP_ESTIMATE_US * 1000ULL) + lineTimeNs(size + 1);
+    if (is_discover) {
+        return bound_ns + (RDM_DUB_WINDOW_US + RDM_READ_LATENCY_US
+            + (RDM_DUB_PREAMBLE_MAX + 1 + RDM_DUB_ENCODED_LENGTH) * DMX_SLOT_TIME_US) * 1000ULL;
+    }
+    return bound_ns + ((timeout_us ? timeout_us : RDM_READ_TIMEOUT_US) + RDM_READ_LATENCY_US) * 1000ULL
+        + lineTimeNs(RDM_MESSAGE_MAX_SLOTS);
+}
+
+// Resend the last DMX frame if an RDM transaction taking rdm_ns from now could leave too long a gap after it
+static void keepDMXGapOpenRDM(int verbose, struct openrdm_context *ctx, uint64_t rdm_ns, const char *description) {
+    if (!ctx->options.max_dmx_gap_us || !ctx->last_frame_size || !ctx->last_frame_ns) return;
+    if (monotonicNs() + rdm_ns <= ctx->last_frame_ns + ctx->options.max_dmx_gap_us * 1000ULL) return;
+    ctx->stats.dmx_gap_refreshes++;
+    if (writeDMXOpenRDM(verbose, ctx, ctx->last_frame, ctx->last_frame_size, description) < 0) return;
+    // The next write replaces the copy, so it can't be left in flight
+    waitDMXOpenRDM(verbose, ctx, description);
+}
+
+static int transactRDMOpenRDM(int verbose, struct openrdm_context *ctx, unsigned char *data, int size, int is_discover, unsigned char *rx_data, unsigned int timeout_us, const char *description) {
+    int ret = waitTransmitOpenRDM(ctx);
+    if (ret < 0) fprintf(stderr, "DMX TX ERROR %d: %s\n", ret, ctx->transport->error_str(ctx));
+    purgeLineOpenRDM(ctx, 1);
+    sendBreakOpenRDM(ctx);
     unsigned char data_sc[513];
     data_sc[0] = RDM_START_CODE;
     memcpy(&data_sc[1], data, size);
-    int ret = ftdi_write_data(ftdi, data_sc, size+1);
+    ret = transmitOpenRDM(ctx, data_sc, size+1);
     if (ret < 0) {
-        fprintf(stderr, "RDM TX ERROR %d: %s\n", ret, ftdi->error_str);
-        // libusb: -110: usb bulk write failed
-        // libusb: -666: USB device unavailable
-        if (ret == -110 || ret == -666) 
-            reinitOpenRDM(verbose, ftdi, description);
+        fprintf(stderr, "RDM TX ERROR %d: %s\n", ret, ctx->transport->error_str(ctx));
+        transferFailedOpenRDM(verbose, ctx, ret, description);
         return ret;
     }
+    // Responses can still be arriving after we stop reading
+    ctx->rx_dirty = 1;
     if (is_discover) {
-        return ftdi_read_data(ftdi, rx_data, 513);
+        return readDiscoveryOpenRDM(ctx, rx_data, 513);
     }
     // if (!has_rx) return 0;
+    // Responder turnaround is timed from the request leaving the line, not from the write returning,
+    // which varies with how much of the request the device still had queued
+    uint64_t deadline_ns = ctx->tx_complete_ns + (timeout_us ? timeout_us : RDM_READ_TIMEOUT_US) * 1000ULL;
     unsigned char i;
-    ret = ftdi_read_data(ftdi, &i, 1); // Discard Break
+    ret = ctx->transport->read(ctx, &i, 1, deadline_ns); // Discard Break
+    if (ret <= 0) return ret;
+    ret = readResponseOpenRDM(ctx, rx_data, 513);
+    if (ret > 0) {
+        uint64_t t_now = monotonicNs();
+        ctx->rdm_response_ns = t_now > ctx->tx_complete_ns ? t_now - ctx->tx_complete_ns : 1;
+        recordInterval(&ctx->stats.rdm_response_time, ctx->rdm_response_ns);
+    }
+    return ret;
+}
+
+// timeout_us is how long to wait for a response to start, 0 for RDM_READ_TIMEOUT_US
+int writeRDMOpenRDM(int verbose, struct openrdm_context *ctx, unsigned char *data, int size, int is_discover, int has_rx, unsigned char *rx_data, unsigned int timeout_us, const char *description) {
+    // A started DMX frame has the line until it is sent
+    finishDMXOpenRDM(verbose, ctx, description);
+    keepDMXGapOpenRDM(verbose, ctx, transactionBoundNs(ctx, size, is_discover, timeout_us), description);
+    uint64_t t_start = monotonicNs();
+    ctx->rdm_response_ns = 0;
+    int ret = transactRDMOpenRDM(verbose, ctx, data, size, is_discover, rx_data, timeout_us, description);
+    uint64_t rdm_ns = monotonicNs() - t_start;
+    recordInterval(&ctx->stats.rdm_time, rdm_ns);
+    if (is_discover) recordInterval(&ctx->stats.dub_time, rdm_ns);
+    uint64_t request_ns = ctx->tx_complete_ns - lineTimeNs(size + 1); // When the request write started
+    if (ret >= 0 && request_ns > t_start) {
+        uint64_t setup_ns = request_ns - t_start;
+        uint64_t decayed_ns = ctx->rdm_setup_ns - ctx->rdm_setup_ns / RDM_SETUP_DECAY;
+        ctx->rdm_setup_ns = setup_ns > decayed_ns ? setup_ns : decayed_ns;
+    }
+    return ret;
+}
+
+static int txDoneOpenRDM(struct openrdm_context *ctx) {
+    if (monotonicNs() < ctx->tx_complete_ns) return 0;
+    return !ctx->transport->done || ctx->transport->done(ctx);
+}
+
+// Wait for the in flight DMX frame to complete and leave the line,
+// after this the buffer passed to writeDMXOpenRDM can be reused
+int waitDMXOpenRDM(int verbose, struct openrdm_context *ctx, const char *description) {
+    int ret = finishDMXOpenRDM(verbose, ctx, description);
     if (ret < 0) return ret;
-    return ftdi_read_data(ftdi, rx_data, 513);
+    uint64_t t_start = monotonicNs();
+    ret = waitTransmitOpenRDM(ctx);
+    ctx->dmx_wait_ns += monotonicNs() - t_start;
+    if (ret < 0) {
+        fprintf(stderr, "DMX TX ERROR %d: %s\n", ret, ctx->transport->error_str(ctx));
+        transferFailedOpenRDM(verbose, ctx, ret, description);
+    }
+    return ret;
 }
 
-int writeDMXOpenRDM(int verbose, struct ftdi_context *ftdi, unsigned char *data, int size, const char *description) {
-    ftdi_usb_purge_rx_buffer(ftdi);
-    ftdi_usb_purge_tx_buffer(ftdi);
-    FT_SetBreakOn(ftdi);
-    usleep(92); // Wait for break time of 92us
-    FT_SetBreakOff(ftdi);
-    unsigned char data_sc[513];
-    data_sc[0] = DMX_START_CODE;
-    memcpy(&data_sc[1], data, size);
-    int ret = ftdi_write_data(ftdi, data_sc, size+1);
+// waitDMXOpenRDM without blocking, returns 0 while the frame is still being sent
+// and 1 once it has left the line, or a negative error
+int pollDMXOpenRDM(int verbose, struct openrdm_context *ctx, const char *description) {
+    if (ctx->dmx_data || !txDoneOpenRDM(ctx)) return 0;
+    int ret = waitDMXOpenRDM(verbose, ctx, description);
+    return ret < 0 ? ret : 1;
+}
+
+// When startDMXOpenRDM can start the next frame's break without waiting, UINT64_MAX while that is
+// until the last frame's transfer completes. A started frame has to be sent first
+uint64_t nextBreakNsOpenRDM(struct openrdm_context *ctx) {
+    if (ctx->dmx_data) return ctx->dmx_break_end_ns;
+    uint64_t break_ns = ctx->tx_complete_ns;
+    if (ctx->last_frame_ns && ctx->last_frame_ns + DMX_MIN_PACKET_US * 1000ULL > break_ns)
+        break_ns = ctx->last_frame_ns + DMX_MIN_PACKET_US * 1000ULL;
+    if (ctx->next_break_ns > break_ns) break_ns = ctx->next_break_ns;
+    if (break_ns <= monotonicNs() && !txDoneOpenRDM(ctx)) return UINT64_MAX;
+    return break_ns;
+}
+
+// The first half of writeDMXOpenRDM, up to turning the break on. The rest is left to finishDMXOpenRDM,
+// which can be called as soon as dmx_break_end_ns, so a caller writing to several devices from
+// one thread can start all their breaks before ending any
+int startDMXOpenRDM(int verbose, struct openrdm_context *ctx, unsigned char *data, int size, const char *description) {
+    int ret = waitDMXOpenRDM(verbose, ctx, description);
+    if (ret < 0) return ret;
+    ctx->dmx_control_transfers = ctx->stats.control_transfers;
+
+    // Keep the frame as written, so a gap refresh repeats this call exactly
+    if (data != ctx->last_frame) {
+        ctx->last_frame_size = size < (int)sizeof(ctx->last_frame) ? size : (int)sizeof(ctx->last_frame);
+        memcpy(ctx->last_frame, data, ctx->last_frame_size);
+    }
+
+    int dmx_size = dmxSizeOpenRDM(ctx, data, size);
+    if (ctx->options.trim_slots) updateTrimOpenRDM(ctx, data, size);
+    // Short frames can leave the line before the minimum break to break time
+    if (ctx->last_frame_ns) waitUntilNs(ctx->last_frame_ns + DMX_MIN_PACKET_US * 1000ULL);
+    // Frames released together on several ports start their breaks at the same time
+    if (ctx->next_break_ns) waitUntilNs(ctx->next_break_ns);
+    ctx->next_break_ns = 0;
+
+    uint64_t t_break = monotonicNs();
+    if (ctx->last_frame_ns) recordInterval(&ctx->stats.frame_interval, t_break - ctx->last_frame_ns);
+    ctx->last_frame_ns = t_break;
+    purgeLineOpenRDM(ctx, 0);
+    ctx->dmx_break_ns = breakOnOpenRDM(ctx);
+    ctx->dmx_break_end_ns = breakEndNsOpenRDM(ctx, ctx->dmx_break_ns);
+    ctx->dmx_data = data;
+    ctx->dmx_size = dmx_size;
+    return 0;
+}
+
+// Ends the break of the frame startDMXOpenRDM started and hands the frame to the device,
+// returns straight away if there isn't one
+int finishDMXOpenRDM(int verbose, struct openrdm_context *ctx, const char *description) {
+    if (!ctx->dmx_data) return 0;
+    unsigned char *data = ctx->dmx_data;
+    int size = ctx->dmx_size;
+    ctx->dmx_data = NULL;
+
+    uint64_t t_break = ctx->last_frame_ns;
+    breakOffOpenRDM(ctx, ctx->dmx_break_ns);
+    ctx->dmx_break_overhead_ns = (7 * ctx->dmx_break_overhead_ns + (monotonicNs() - t_break)) / 8;
+    int ret;
+    if (ctx->options.async) {
+        ret = submitOpenRDM(ctx, data, size);
+    } else {
+        ret = transmitOpenRDM(ctx, data, size);
+    }
     if (ret < 0) {
-        fprintf(stderr, "DMX TX ERROR %d: %s\n", ret, ftdi->error_str);
-        // libusb: -110: usb bulk write failed
-        // libusb: -666: USB device unavailable
-        if (ret == -110 || ret == -666) 
-            reinitOpenRDM(verbose, ftdi, description);
+        fprintf(stderr, "DMX TX ERROR %d: %s\n", ret, ctx->transport->error_str(ctx));
+        transferFailedOpenRDM(verbose, ctx, ret, description);
         return ret;
     }
+
+    recordInterval(&ctx->stats.tx_latency, monotonicNs() - t_break);
+
+    // Blocked time includes waiting for the previous frame, which the caller may have done first
+    uint64_t blocked_ns = ctx->dmx_wait_ns + monotonicNs() - t_break;
+    ctx->dmx_wait_ns = 0;
+    ctx->stats.dmx_frames++;
+    ctx->stats.dmx_slots += size - 1;
+    ctx->stats.dmx_control_transfers += ctx->stats.control_transfers - ctx->dmx_control_transfers;
+    ctx->stats.dmx_blocked_ns += blocked_ns;
+    if (blocked_ns > ctx->stats.dmx_blocked_max_ns) ctx->stats.dmx_blocked_max_ns = blocked_ns;
     return 0;
-}
\ No newline at end of file
+}
+
+// data includes the start code and is sent without copying,
+// so it must stay valid until waitDMXOpenRDM or the next write returns
+int writeDMXOpenRDM(int verbose, struct openrdm_context *ctx, unsigned char *data, int size, const char *description) {
+    int ret = startDMXOpenRDM(verbose, ctx, data, size, description);
+    if (ret < 0) return ret;
+    return finishDMXOpenRDM(verbose, ctx, description);
+}
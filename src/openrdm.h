@@ -1,4 +1,3 @@
-
 #ifndef __OPENRDM_H__
 #define __OPENRDM_H__
 
@@ -6,23 +5,138 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
 #include <ftdi.h>
 
+#include "dmx.h"
+#include "openrdm_timing.h"
+#include "openrdm_transport.h"
+
 #define OPENRDM_VID 0x0403
 #define OPENRDM_PID 0x6001
 
 #define BAUDRATE 250000 //250kBaud
 
+// Frames to keep sending trimmed slots for after they drop to 0, so fixtures see the 0
+#define TRIM_HOLD_FRAMES 3
+
+// Most file descriptors a device is expected to need watching
+#define OPENRDM_MAX_POLL_FDS 8
+
+// How long to wait for each part of an RDM response
+#define RDM_READ_TIMEOUT_US 20000
+// The FTDI sends received bytes after this long even if it hasn't filled a USB packet,
+// and a packet without data once the line is quiet, so reads don't wait out the 16ms default
+#define FTDI_LATENCY_TIMER_MS 1
+// Read one full speed USB packet at a time, a response only needs a few
+#define FTDI_READ_CHUNK_SIZE 64
+// Longest a received byte can take to reach us, the latency timer plus a USB frame
+#define RDM_READ_LATENCY_US ((FTDI_LATENCY_TIMER_MS + 1) * 1000)
+// E1.20 responders start a discovery response within this long of the request leaving the line
+#define RDM_DUB_WINDOW_US 2800
+// A discovery response is up to 7 preamble bytes, a delimiter and the encoded UID and checksum
+#define RDM_DUB_PREAMBLE_MAX 7
+#define RDM_DUB_ENCODED_LENGTH 16
+// Start code through checksum of the longest RDM message
+#define RDM_MESSAGE_MAX_SLOTS 257
+// Longest getting an RDM request onto the line is assumed to take before one has been timed
+#define RDM_SETUP_ESTIMATE_US 5000
+// The request setup time is a max that loses 1/RDM_SETUP_DECAY of itself every transaction,
+// so one slow USB transfer stops counting against max_dmx_gap_us after a few dozen
+#define RDM_SETUP_DECAY 8
+
 // UDEV rule: SUBSYSTEM=="usb", ATTR{idProduct}=="6001", ATTRS{idVendor}=="0403", MODE="0666"
 
+struct openrdm_options {
+    int async; // Submit DMX frames without waiting for the USB transfer to complete
+    int always_purge; // Purge RX and TX before every frame instead of only when needed
+    unsigned int break_us; // Break and mark after break targets
+    unsigned int mab_us;
+    unsigned int max_slots; // Cap the slots sent per DMX frame, 0 for no cap
+    int trim_slots; // Don't send trailing 0 slots
+    unsigned int min_slots; // Always send at least this many slots when trimming
+    unsigned int max_dmx_gap_us; // Resend the last DMX frame before an RDM transaction that could leave a longer gap, 0 for no limit
+};
+
+struct openrdm_stats {
+    uint64_t dmx_frames;
+    uint64_t dmx_blocked_ns; // Total time spent blocked in writeDMXOpenRDM
+    uint64_t dmx_blocked_max_ns;
+    uint64_t dmx_control_transfers; // Control transfers made while sending DMX frames
+    uint64_t control_transfers;
+    uint64_t bulk_transfers;
+    uint64_t purges; // RX or TX buffer purges performed
+    uint64_t purges_skipped; // RX or TX buffer purges skipped as the buffer was already clean
+    struct openrdm_interval_stats break_time;
+    struct openrdm_interval_stats mab_time;
+    struct openrdm_interval_stats frame_interval; // Time between DMX frame starts
+    struct openrdm_interval_stats tx_latency; // Time from the start of the break to the frame being handed to the device
+    uint64_t dmx_slots; // Total slots sent in DMX frames
+    uint64_t dmx_gap_refreshes; // Frames resent between RDM transactions to stay within max_dmx_gap_us
+    struct openrdm_interval_stats rdm_time; // Time taken by each RDM transaction
+    struct openrdm_interval_stats rdm_response_time; // From sending a request to reading its response checksum
+    struct openrdm_interval_stats dub_time; // Time taken by each discovery unique branch transaction
+};
+
+struct openrdm_context {
+    const struct openrdm_transport *transport;
+    int opened;
+    struct ftdi_context ftdi;
+    int tty_fd;
+    int tty_errno;
+    struct openrdm_options options;
+    int rx_dirty; // An RDM transaction may have left unread data in the RX buffer
+    int tx_dirty; // A failed write may have left data in the TX buffer
+    struct ftdi_transfer_control *tx_transfer; // In flight asynchronous libftdi transfer
+    uint64_t tx_complete_ns; // Time the last frame has left the line
+    uint64_t stub_usb_complete_ns; // Time the simulated USB transfer completes
+    unsigned char stub_rx_data[DMX_MAX_LENGTH+1]; // Reply the simulated responder put on the line
+    int stub_rx_size;
+    int stub_rx_pos; // How much of it has been read
+    uint64_t stub_rx_start_ns; // When its first byte reaches us
+    uint64_t control_half_latency_ns; // Half the average control transfer time, used to time the break
+    uint64_t last_frame_ns; // Start of the previous DMX frame
+    uint64_t dmx_break_overhead_ns; // Smoothed time from the end of the last frame to the next one being written
+    uint64_t dmx_wait_ns; // Time spent waiting for the previous frame, counted as part of the next frame
+    int trim_extent; // Slots sent before trimming last shrunk the frame
+    int trim_hold; // Frames left before trim_extent can shrink
+    unsigned char last_frame[DMX_MAX_LENGTH+1]; // Copy of the last DMX frame written, for gap refreshes
+    int last_frame_size;
+    uint64_t rdm_setup_ns; // Time from starting an RDM transaction to its request leaving the line, decaying max
+    uint64_t rdm_response_ns; // Time the last RDM response took to arrive, 0 if there wasn't one
+    uint64_t next_break_ns; // Earliest start of the next DMX frame's break, 0 to start as soon as possible
+    unsigned char *dmx_data; // Frame startDMXOpenRDM has broken for, NULL once finishDMXOpenRDM has sent it
+    int dmx_size;
+    uint64_t dmx_break_ns; // When the started frame's break went on
+    uint64_t dmx_break_end_ns; // When finishDMXOpenRDM starts turning the started frame's break off
+    uint64_t dmx_control_transfers; // Control transfer count before the started frame
+    int defer_reinit; // Leave reopening after a failed transfer to reinitPendingOpenRDM
+    int reinit_pending;
+    struct openrdm_stats stats;
+};
+
+void defaultOpenRDMOptions(struct openrdm_options *options);
+void clearOpenRDMContext(struct openrdm_context *ctx);
+int dmxSizeOpenRDM(struct openrdm_context *ctx, const unsigned char *data, int size);
+uint64_t frameTimeNsOpenRDM(struct openrdm_context *ctx, const unsigned char *data, int size);
 int findOpenRDMDevices(int verbose);
-int initOpenRDM(int verbose, struct ftdi_context *ftdi, const char *description);
-void deinitOpenRDM(int verbose, struct ftdi_context *ftdi);
-int writeRDMOpenRDM(int verbose, struct ftdi_context *ftdi, unsigned char *data, int size, int is_discover, int has_rx, unsigned char *rx_data, const char *description);
-int writeDMXOpenRDM(int verbose, struct ftdi_context *ftdi, unsigned char *data, int size, const char *description);
+int watchHotplugOpenRDM(int verbose, void (*callback)(int arrived, void *user), void *user);
+int busNumberOpenRDM(struct openrdm_context *ctx);
+int pollFdsOpenRDM(struct openrdm_context *ctx, struct pollfd *fds, int max);
+void handleEventsOpenRDM(struct openrdm_context *ctx);
+int initOpenRDM(int verbose, struct openrdm_context *ctx, const char *description);
+void deinitOpenRDM(int verbose, struct openrdm_context *ctx);
+void reinitPendingOpenRDM(int verbose, struct openrdm_context *ctx, const char *description);
+int writeRDMOpenRDM(int verbose, struct openrdm_context *ctx, unsigned char *data, int size, int is_discover, int has_rx, unsigned char *rx_data, unsigned int timeout_us, const char *description);
+int waitDMXOpenRDM(int verbose, struct openrdm_context *ctx, const char *description);
+int pollDMXOpenRDM(int verbose, struct openrdm_context *ctx, const char *description);
+uint64_t nextBreakNsOpenRDM(struct openrdm_context *ctx);
+int startDMXOpenRDM(int verbose, struct openrdm_context *ctx, unsigned char *data, int size, const char *description);
+int finishDMXOpenRDM(int verbose, struct openrdm_context *ctx, const char *description);
+int writeDMXOpenRDM(int verbose, struct openrdm_context *ctx, unsigned char *data, int size, const char *description);
 
 #ifdef __cplusplus
 }
 #endif
 
-#endif // __OPENRDM_H__
\ No newline at end of file
+#endif // __OPENRDM_H__
@@ -0,0 +1,37 @@
+#ifndef __OPENRDM_CLOCK_HPP__
+#define __OPENRDM_CLOCK_HPP__
+
+#include <chrono>
+#include <cstdint>
+
+#include "openrdm_timing.h"
+
+// Waits until wait_for(real timeout) returns true or the OpenRDM clock reaches deadline_ns,
+// returns false on timeout. wait_for blocks on whatever is being waited for, a semaphore,
+// condition variable or fd, for at most the timeout it is given
+template <typename F>
+bool waitOnClock(uint64_t deadline_ns, F &&wait_for) {
+    auto *clock = getClockOpenRDM();
+    if (clock->wait_slice_ns == 0) {
+        uint64_t now = monotonicNs();
+        return wait_for(std::chrono::nanoseconds(deadline_ns > now ? deadline_ns - now : 0));
+    }
+    // Time only passes on a simulated clock once every thread is waiting, so check it in slices
+    clock->begin_wait(deadline_ns);
+    bool ready = false;
+    while (!(ready = wait_for(std::chrono::nanoseconds(clock->wait_slice_ns))) && monotonicNs() < deadline_ns);
+    clock->end_wait(deadline_ns);
+    return ready;
+}
+
+// Runs wait, which blocks with no deadline until another thread does something, letting a
+// simulated clock move on meanwhile
+template <typename F>
+void blockOnClock(F &&wait) {
+    auto *clock = getClockOpenRDM();
+    clock->begin_wait(UINT64_MAX);
+    wait();
+    clock->end_wait(UINT64_MAX);
+}
+
+#endif // __OPENRDM_CLOCK_HPP__
@@ -1,5 +1,7 @@
 
 #include <algorithm>
+#include <cmath>
+#include <cinttypes>
 #include <thread>
 #include <chrono>
 #include <memory>
@@ -11,7 +13,12 @@ OpenRDMDevice::OpenRDMDevice() {
     this->verbose = 0;
     this->rdm_enabled = false;
     this->rdm_debug = false;
-    this->dev_mutex = std::make_unique<std::mutex>();
+    this->frame_time_ns = std::make_unique<std::atomic<uint64_t>>(0);
+    this->timed_break_ns = std::make_unique<std::atomic<uint64_t>>(0);
+    this->initialized = std::make_unique<std::atomic<bool>>(false);
+    this->actor = std::make_unique<OpenRDMDeviceActor>();
+    this->controller_mutex = std::make_unique<std::mutex>();
+    clearOpenRDMContext(&ctx);
 }
 
 OpenRDMDevice::OpenRDMDevice(std::string ftdi_description, bool verbose, bool rdm_enabled, bool rdm_debug) {
@@ -19,110 +26,531 @@ OpenRDMDevice::OpenRDMDevice(std::string ftdi_description, bool verbose, bool rd
     this->verbose = verbose;
     this->rdm_enabled = rdm_enabled;
     this->rdm_debug = rdm_debug;
-    this->dev_mutex = std::make_unique<std::mutex>();
+    this->frame_time_ns = std::make_unique<std::atomic<uint64_t>>(0);
+    this->timed_break_ns = std::make_unique<std::atomic<uint64_t>>(0);
+    this->initialized = std::make_unique<std::atomic<bool>>(false);
+    this->actor = std::make_unique<OpenRDMDeviceActor>();
+    this->controller_mutex = std::make_unique<std::mutex>();
+    clearOpenRDMContext(&ctx);
 }
 
 bool OpenRDMDevice::init() {
-    this->dev_mutex->lock();
-    int ret = initOpenRDM(verbose, &ftdi, ftdi_description.c_str());
-    this->dev_mutex->unlock();
+    startInit();
+    return *pollInit(true);
+}
+
+bool OpenRDMDevice::startInit() {
+    if (init_result.valid()) return false;
+    auto result = std::make_shared<std::promise<bool>>();
+    init_result = result->get_future();
+    actor->submit(OpenRDMPriority::DMX, [this, result] { openDevice(result); });
+    return true;
+}
+
+std::optional<bool> OpenRDMDevice::pollInit(bool block) {
+    if (!init_result.valid()) return std::nullopt;
+    if (block) {
+        actor->wait(init_result);
+    } else if (init_result.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        return std::nullopt;
+    }
+    return init_result.get();
+}
+
+void OpenRDMDevice::deinit() {
+    if (!isInitialized()) return;
+    actor->call(OpenRDMPriority::DMX, [this] { closeDevice(); });
+}
+
+// Only call from the actor's thread. A discovery left running when the device was lost fails its
+// remaining transactions, the device is only opened and its state reset once it has returned
+void OpenRDMDevice::openDevice(std::shared_ptr<std::promise<bool>> result) {
+    controller_mutex->lock();
+    bool waiting = discovery_running;
+    if (waiting) pending_open = result;
+    controller_mutex->unlock();
+    if (waiting) return;
+
+    int ret = initOpenRDM(verbose, &ctx, ftdi_description.c_str());
+    // Until a frame is written, schedule as if an empty one was
+    uint8_t start_code = DMX_START_CODE;
+    frame_time_ns->store(frameTimeNsOpenRDM(&ctx, &start_code, 1));
     if (ret) {
         uid = generateUID(ftdi_description);
-        discovery_in_progress = false;
         rdm_transaction_number = 0;
         tod = UIDList();
         lost = UIDList();
         proxies = UIDList();
-        initialized = true;
-        return true;
+        initialized->store(true, std::memory_order_release);
+    } else if (isInitialized()) {
+        closeDevice();
     }
-    deinit();
-    return false;
+    result->set_value(ret != 0);
 }
 
-void OpenRDMDevice::deinit() {
-    if (!initialized) return;
-    this->dev_mutex->lock();
-    deinitOpenRDM(verbose, &ftdi);
-    this->dev_mutex->unlock();
-    initialized = false;
+// Only call from the actor's thread
+void OpenRDMDevice::closeDevice() {
+    deinitOpenRDM(verbose, &ctx);
+    initialized->store(false, std::memory_order_release);
+    // Discovery parked on an ACK_TIMER would otherwise hold up reopening until it is due
+    controller_mutex->lock();
+    wakeAckTimers();
+    controller_mutex->unlock();
 }
 
-bool OpenRDMDevice::isInitialized() { return initialized; }
+bool OpenRDMDevice::isInitialized() { return initialized->load(std::memory_order_acquire); }
 
 std::string OpenRDMDevice::getDescription() { return ftdi_description; }
 
+void OpenRDMDevice::setOptions(const struct openrdm_options &options) {
+    actor->call(OpenRDMPriority::DMX, [&] { ctx.options = options; });
+}
+
+uint64_t OpenRDMDevice::getFrameTimeNs() {
+    return frame_time_ns->load(std::memory_order_relaxed);
+}
+
+uint64_t OpenRDMDevice::getTimedBreakNs() {
+    return timed_break_ns->load(std::memory_order_relaxed);
+}
+
+struct openrdm_stats OpenRDMDevice::getStats() {
+    return actor->call(OpenRDMPriority::DMX, [this] { return ctx.stats; });
+}
+
+std::future<struct openrdm_stats> OpenRDMDevice::requestStats() {
+    return actor->submit(OpenRDMPriority::DMX, [this] { return ctx.stats; });
+}
+
+OpenRDMQueueStats OpenRDMDevice::getQueueStats() {
+    return actor->getStats();
+}
+
+int OpenRDMDevice::getBusNumber() {
+    return actor->call(OpenRDMPriority::DMX, [this] { return busNumberOpenRDM(&ctx); });
+}
+
+void OpenRDMDevice::drive(std::function<void()> wake) {
+    actor->drive(std::move(wake));
+    driven = true;
+    // Nothing has run on the actor yet, so ctx can still be set from here
+    ctx.defer_reinit = 1;
+}
+
+bool OpenRDMDevice::runQueued(OpenRDMPriority lowest) {
+    return actor->runQueued(lowest);
+}
+
+uint64_t OpenRDMDevice::nextTimerNs() {
+    return actor->nextTimerNs();
+}
+
+std::optional<std::vector<struct pollfd>> OpenRDMDevice::getPollFds() {
+    auto fds = std::vector<struct pollfd>(OPENRDM_MAX_POLL_FDS);
+    int count = 0;
+    if (!actor->tryRun([&] { count = isInitialized() ? pollFdsOpenRDM(&ctx, fds.data(), fds.size()) : 0; })) return std::nullopt;
+    fds.resize(count);
+    return fds;
+}
+
+// Whoever is running a command is already waiting on the device, so there is nothing to do if it is busy
+void OpenRDMDevice::handleEvents() {
+    actor->tryRun([this] { if (isInitialized()) handleEventsOpenRDM(&ctx); });
+}
+
+pthread_t OpenRDMDevice::getThreadHandle() {
+    return actor->call(OpenRDMPriority::DMX, [] { return pthread_self(); });
+}
+
 void OpenRDMDevice::findDevices(bool verbose) {
     findOpenRDMDevices(verbose);
 }
 
-void OpenRDMDevice::writeDMX(uint8_t *data, int len) {
-    if (!initialized) return;
-    this->dev_mutex->lock();
-    int ret = writeDMXOpenRDM(verbose, &ftdi, data, len, ftdi_description.c_str());
-    this->dev_mutex->unlock();
-    if (ret < 0) { // Error occurred
-        // -666: USB device unavailable, device disconnected
-        if (ret == -666) deinit();
-        // if (ret == -666) std::this_thread::sleep_for(std::chrono::seconds(1));
-        //  -19: usb bulk write failed, device disconnected
-        if (ret == -19) deinit();
+// Returns false without waiting if block is false and the last frame hasn't finished sending
+bool OpenRDMDevice::waitDMX(bool block) {
+    if (!isInitialized()) return true;
+    if (!block) {
+        // A driven write can still be waiting to start, and needs its data until it has gone out
+        if (dmx_sent.valid()) {
+            if (dmx_sent.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return false;
+            dmx_sent = std::future<void>();
+        }
+        // Never waits, if another thread is running a command on the device the caller just tries again later
+        int ret = 0;
+        actor->tryRun([&] {
+            if (!isInitialized()) {
+                ret = 1;
+                return;
+            }
+            ret = pollDMXOpenRDM(verbose, &ctx, ftdi_description.c_str());
+            checkDMX(ret);
+        });
+        return ret != 0;
+    }
+    if (dmx_sent.valid()) {
+        actor->wait(dmx_sent);
+        dmx_sent = std::future<void>();
+    }
+    if (!dmx_wait.valid()) {
+        dmx_wait = actor->submit(OpenRDMPriority::DMX, [this] {
+            if (!isInitialized()) return 0;
+            int ret = waitDMXOpenRDM(verbose, &ctx, ftdi_description.c_str());
+            checkDMX(ret);
+            return ret;
+        });
+    }
+    actor->wait(dmx_wait);
+    dmx_wait.get();
+    return true;
+}
+
+// Queues the frame and returns straight away, data includes the start code and must not be
+// modified until waitDMX returns. A non zero start_ns holds the break back until then
+void OpenRDMDevice::writeDMX(uint8_t *data, int len, uint64_t start_ns) {
+    if (!isInitialized()) return;
+    if (driven) {
+        auto sent = std::make_shared<std::promise<void>>();
+        dmx_sent = sent->get_future();
+        actor->submit(OpenRDMPriority::DMX, [this, data, len, start_ns, sent] { startDMX(data, len, start_ns, sent); });
+        actor->runQueued(OpenRDMPriority::DMX);
+        return;
+    }
+    actor->submit(OpenRDMPriority::DMX, [this, data, len, start_ns] {
+        if (!isInitialized()) return;
+        frame_time_ns->store(frameTimeNsOpenRDM(&ctx, data, len), std::memory_order_relaxed);
+        ctx.next_break_ns = start_ns;
+        int ret = writeDMXOpenRDM(verbose, &ctx, data, len, ftdi_description.c_str());
+        if (start_ns && ret >= 0) timed_break_ns->store(ctx.last_frame_ns, std::memory_order_relaxed);
+        checkDMX(ret);
+    });
+}
+
+// Only call from the actor's thread. On a driven device every wait in writing a frame is an actor
+// timer instead, so the thread running it isn't held up and can start the breaks of other devices
+// while this one's lasts
+void OpenRDMDevice::startDMX(uint8_t *data, int len, uint64_t start_ns, std::shared_ptr<std::promise<void>> sent) {
+    if (!isInitialized()) {
+        sent->set_value();
+        return;
+    }
+    ctx.next_break_ns = start_ns;
+    uint64_t break_ns = nextBreakNsOpenRDM(&ctx);
+    uint64_t t_now = monotonicNs();
+    if (break_ns > t_now) {
+        // Waiting on the transfer to complete, check on it again shortly
+        if (break_ns == UINT64_MAX) break_ns = t_now + DMX_TRANSFER_POLL_US * 1000ULL;
+        actor->submitAt(OpenRDMPriority::DMX, break_ns, [this, data, len, start_ns, sent] { startDMX(data, len, start_ns, sent); });
+        return;
+    }
+    frame_time_ns->store(frameTimeNsOpenRDM(&ctx, data, len), std::memory_order_relaxed);
+    int ret = startDMXOpenRDM(verbose, &ctx, data, len, ftdi_description.c_str());
+    if (ret < 0) {
+        checkDMX(ret);
+        sent->set_value();
+        return;
+    }
+    if (start_ns) timed_break_ns->store(ctx.last_frame_ns, std::memory_order_relaxed);
+    actor->submitAt(OpenRDMPriority::DMX, ctx.dmx_break_end_ns, [this, sent] { finishDMX(sent); });
+}
+
+// Only call from the actor's thread, the frame may already have been sent by whatever used the line next
+void OpenRDMDevice::finishDMX(std::shared_ptr<std::promise<void>> sent) {
+    if (isInitialized()) checkDMX(finishDMXOpenRDM(verbose, &ctx, ftdi_description.c_str()));
+    sent->set_value();
+}
+
+// Only call from the actor's thread, with the result of a DMX operation
+void OpenRDMDevice::checkDMX(int ret) {
+    // -666: USB device unavailable, device disconnected
+    //  -19: usb bulk write failed, device disconnected
+    if (ret == -666 || ret == -19) closeDevice();
+    // A driven device is reopened between RDM transactions, off the thread running its DMX
+    if (ctx.reinit_pending) {
+        actor->submit(OpenRDMPriority::RDM, [this] { reinitPendingOpenRDM(verbose, &ctx, ftdi_description.c_str()); });
+    }
+}
+
+// Only call from the actor's thread
+int OpenRDMDevice::runTransaction(uint8_t *data, int len, bool is_discover, bool has_rx, uint8_t *rx_data) {
+    // -19: device disconnected
+    if (!isInitialized()) return -19;
+    UID dest = len >= 2+RDM_UID_LENGTH && data[0] == RDM_SUB_START_CODE ? getUID(&data[2]) : (UID)RDM_UID_BROADCAST;
+    bool unicast = (dest & (UID)RDM_UID_MFR_BROADCAST) != (UID)RDM_UID_MFR_BROADCAST;
+    if (is_discover || !has_rx || !unicast) {
+        int ret = writeRDMOpenRDM(verbose, &ctx, data, len, is_discover, has_rx, rx_data, 0, ftdi_description.c_str());
+        reinitPendingOpenRDM(verbose, &ctx, ftdi_description.c_str());
+        return ret;
+    }
+    // Addressed to one responder, wait as long as it usually takes unless it has stopped answering
+    unsigned int timeout_us;
+    bool is_mute = len > 19 && data[19] == RDM_CC_DISCOVER;
+    if (!admitUIDRequest(dest, is_mute, timeout_us)) return 0;
+    uint64_t t_start = monotonicNs();
+    int ret = writeRDMOpenRDM(verbose, &ctx, data, len, is_discover, has_rx, rx_data, timeout_us, ftdi_description.c_str());
+    recordUIDResponse(dest, ret, ctx.rdm_response_ns, monotonicNs() - t_start);
+    reinitPendingOpenRDM(verbose, &ctx, ftdi_description.c_str());
+    return ret;
+}
+
+unsigned int RDMUIDStats::timeoutUs() const {
+    if (responses < RDM_UID_MIN_SAMPLES) return 0;
+    double timeout_us = srtt_us + 4 * rttvar_us;
+    if (timeout_us < RDM_UID_TIMEOUT_MIN_US) return RDM_UID_TIMEOUT_MIN_US;
+    if (timeout_us > RDM_READ_TIMEOUT_US) return RDM_READ_TIMEOUT_US;
+    return (unsigned int)timeout_us;
+}
+
+unsigned int RDMUIDStats::maxRetries(unsigned int retries) const {
+    if (responses < RDM_UID_MIN_SAMPLES) return retries;
+    // Enough retries that all of them missing is a one in a thousand chance at its miss rate
+    double miss_rate = 1.0 - (double)responses / requests;
+    unsigned int needed = miss_rate <= 0 ? 1 : (unsigned int)std::ceil(std::log(0.001) / std::log(miss_rate)) - 1;
+    return std::clamp(needed, 1U, std::max(retries, 1U));
+}
+
+// Returns false if a request to a quarantined UID should be answered locally with a timeout,
+// otherwise sets the timeout to send it with
+bool OpenRDMDevice::admitUIDRequest(UID dest, bool is_mute, unsigned int &timeout_us) {
+    std::lock_guard<std::mutex> lock(*controller_mutex);
+    timeout_us = 0;
+    auto it = uid_stats.find(dest);
+    if (it == uid_stats.end()) return true;
+    auto &stats = it->second;
+    timeout_us = stats.timeoutUs();
+    // Mutes are how discovery finds it again
+    if (!stats.quarantined || is_mute) return true;
+    uint64_t now = monotonicNs();
+    if (now >= stats.next_probe_ns) {
+        stats.probes++;
+        stats.next_probe_ns = now + RDM_QUARANTINE_PROBE_MS * 1000000ULL;
+        return true;
+    }
+    stats.skipped++;
+    stats.saved_ns += stats.miss_ns;
+    return false;
+}
+
+void OpenRDMDevice::recordUIDResponse(UID dest, int ret, uint64_t response_ns, uint64_t transaction_ns) {
+    if (ret < 0) return; // The device failed, not the responder
+    std::lock_guard<std::mutex> lock(*controller_mutex);
+    auto &stats = uid_stats[dest];
+    stats.requests++;
+    if (ret == 0 || response_ns == 0) {
+        stats.miss_ns = transaction_ns;
+        if (++stats.consecutive_misses >= RDM_QUARANTINE_MISSES && !stats.quarantined) {
+            stats.quarantined = true;
+            stats.quarantines++;
+            stats.next_probe_ns = monotonicNs() + RDM_QUARANTINE_PROBE_MS * 1000000ULL;
+            if (verbose) printf("RDM Device %012" PRIx64 " quarantined after %u missed responses\n", dest, stats.consecutive_misses);
+        }
+        return;
+    }
+    if (stats.quarantined && verbose) printf("RDM Device %012" PRIx64 " answered, quarantine lifted\n", dest);
+    stats.consecutive_misses = 0;
+    stats.quarantined = false;
+    stats.responses++;
+    recordInterval(&stats.response_time, response_ns);
+    double sample_us = response_ns / 1e3;
+    if (stats.responses == 1) {
+        stats.srtt_us = sample_us;
+        stats.rttvar_us = sample_us / 2;
+    } else {
+        stats.rttvar_us = 0.75 * stats.rttvar_us + 0.25 * std::abs(stats.srtt_us - sample_us);
+        stats.srtt_us = 0.875 * stats.srtt_us + 0.125 * sample_us;
     }
 }
 
+RDMUIDStatsMap OpenRDMDevice::getUIDStats() {
+    std::lock_guard<std::mutex> lock(*controller_mutex);
+    return uid_stats;
+}
+
+// A single RDM transaction, DMX queued while it runs goes out before the next one
+int OpenRDMDevice::transactRDM(uint8_t *data, int len, bool is_discover, bool has_rx, uint8_t *rx_data) {
+    return actor->call(OpenRDMPriority::RDM, [&] { return runTransaction(data, len, is_discover, has_rx, rx_data); });
+}
+
+void OpenRDMDevice::RDMTransaction::await_suspend(std::coroutine_handle<> h) {
+    dev->actor->submit(OpenRDMPriority::RDM, [this, h] {
+        result = dev->runTransaction(data, len, is_discover, has_rx, rx_data);
+        h.resume();
+    });
+}
+
+void OpenRDMDevice::RDMDelay::await_suspend(std::coroutine_handle<> h) {
+    dev->actor->submitAt(OpenRDMPriority::RDM, monotonicNs() + (uint64_t)(delay_ms * 1e6), [h] { h.resume(); });
+}
+
+OpenRDMDevice::RDMTransaction OpenRDMDevice::asyncRDM(uint8_t *data, int len, bool is_discover, bool has_rx, uint8_t *rx_data) {
+    return RDMTransaction{this, data, len, is_discover, has_rx, rx_data};
+}
+
+OpenRDMDevice::RDMDelay OpenRDMDevice::delayRDM(double delay_ms) {
+    return RDMDelay{this, delay_ms};
+}
+
+// Starts task on the actor, DMX frames keep going out between its transactions
+template <typename T>
+std::future<T> OpenRDMDevice::startRDM(RDMTask<T> task, std::function<void()> done) {
+    auto result = std::make_shared<std::promise<T>>();
+    auto future = result->get_future();
+    auto runner = std::make_shared<RDMTask<T>>(std::move(task));
+    actor->submit(OpenRDMPriority::RDM, [runner, result, done] { runRDMTask(std::move(*runner), result, done); });
+    return future;
+}
+
 std::pair<int, RDMData> OpenRDMDevice::writeRDM(uint8_t *data, int len) {
-    if (!initialized) return std::make_pair(0, RDMData());
+    if (!isInitialized() || monotonicNs() < rdm_backoff_ns) return std::make_pair(0, RDMData());
     auto resp = RDMData();
     auto pkt = RDMPacket(data, len);
     auto rx_expected = pkt.isValid() ? pkt.hasRx() : true; // If packet is invalid, assume response
-    this->dev_mutex->lock();
-    int resp_len = writeRDMOpenRDM(verbose, &ftdi, data, len, false, rx_expected, resp.begin(), ftdi_description.c_str());
-    this->dev_mutex->unlock();
+    bool unmutes = pkt.isValid() && pkt.cc == RDM_CC_DISCOVER && pkt.pid == RDM_PID_DISC_UNMUTE;
+    int resp_len = controllerRDM(data, len, rx_expected, resp.begin(), unmutes);
     if (resp_len < 0) { // Error occurred
         // only deinit from writeDMX to prevent random errors resetting module
-        // -666: USB device unavailable, wait a bit to avoid spam
-        if (resp_len == -666) std::this_thread::sleep_for(std::chrono::seconds(1));
+        // -666: USB device unavailable, back off a bit to avoid spam
         //  -19: usb bulk write failed, device disconnected
-        if (resp_len == -19) std::this_thread::sleep_for(std::chrono::seconds(1));
+        // Without sleeping, so a thread shared with other ports keeps serving them
+        if (resp_len == -666 || resp_len == -19) rdm_backoff_ns = monotonicNs() + RDM_ERROR_BACKOFF_MS * 1000000ULL;
         return std::make_pair(0, RDMData());
     }
     return std::make_pair(resp_len, resp);
 }
 
-UIDList OpenRDMDevice::fullRDMDiscovery() {
-    if (!initialized) return UIDList();
-    if (discovery_in_progress || !rdm_enabled) return UIDList();
+// Controller requests go straight to the device, unless discovery is running when they wait for
+// it to reach a branch boundary
+int OpenRDMDevice::controllerRDM(uint8_t *data, int len, bool has_rx, uint8_t *rx_data, bool unmutes) {
+    uint64_t t_start = monotonicNs();
+    controller_mutex->lock();
+    if (!discovery_running) {
+        controller_mutex->unlock();
+        return transactRDM(data, len, false, has_rx, rx_data);
+    }
+    auto request = RDMControllerRequest{data, len, has_rx, rx_data, unmutes, std::promise<int>()};
+    auto result = request.result.get_future();
+    controller_requests.push_back(&request);
+    // Discovery parked on an ACK_TIMER isn't heading for a branch boundary, wake it to serve the request
+    wakeAckTimers();
+    controller_mutex->unlock();
+
+    actor->wait(result);
+    int ret = result.get();
+    controller_mutex->lock();
+    recordInterval(&rdm_stats.controller_latency, monotonicNs() - t_start);
+    controller_mutex->unlock();
+    return ret;
+}
 
-    discovery_in_progress = true;
+// Serves the controller requests waiting on discovery, returns true if any unmuted devices
+RDMTask<bool> OpenRDMDevice::serveControllerRequests() {
+    bool unmuted = false;
+    while (true) {
+        controller_mutex->lock();
+        if (controller_requests.empty()) {
+            controller_mutex->unlock();
+            break;
+        }
+        auto *request = controller_requests.front();
+        controller_requests.pop_front();
+        controller_mutex->unlock();
+
+        int ret = co_await asyncRDM(request->data, request->len, false, request->has_rx, request->rx_data);
+        unmuted |= request->unmutes;
+        request->result.set_value(ret);
+    }
+    co_return unmuted;
+}
+
+bool OpenRDMDevice::startFullRDMDiscovery(std::function<void()> done) {
+    return startDiscovery(false, done);
+}
+
+bool OpenRDMDevice::startIncrementalRDMDiscovery(std::function<void()> done) {
+    return startDiscovery(true, done);
+}
+
+bool OpenRDMDevice::startDiscovery(bool incremental, std::function<void()> done) {
+    if (!isInitialized() || !rdm_enabled) return false;
+    if (discovery_result.valid()) return false;
+    controller_mutex->lock();
+    discovery_running = true;
+    controller_mutex->unlock();
+    discovery_result = startRDM(runDiscovery(incremental), done);
+    return true;
+}
+
+std::optional<RDMDiscoveryResult> OpenRDMDevice::pollRDMDiscovery() {
+    if (!discovery_result.valid()) return std::nullopt;
+    if (discovery_result.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return std::nullopt;
+    return discovery_result.get();
+}
+
+RDMDiscoveryStats OpenRDMDevice::getRDMStats() {
+    controller_mutex->lock();
+    auto stats = rdm_stats;
+    stats.ack_timers_pending = deferred_acks.size();
+    controller_mutex->unlock();
+    return stats;
+}
+
+RDMTask<RDMDiscoveryResult> OpenRDMDevice::runDiscovery(bool incremental) {
+    auto result = RDMDiscoveryResult();
+    auto dub_start = ctx.stats.dub_time;
+    if (incremental) {
+        auto changes = co_await incrementalDiscovery();
+        result.added = changes.first;
+        result.removed = changes.second;
+    } else {
+        result.added = co_await fullDiscovery();
+    }
+    // Serve anything that arrived after the last branch, checking under the lock so a request
+    // can't be queued just as we stop looking
+    std::shared_ptr<std::promise<bool>> open;
+    while (true) {
+        controller_mutex->lock();
+        if (controller_requests.empty()) {
+            discovery_running = false;
+            open = std::move(pending_open);
+            controller_mutex->unlock();
+            break;
+        }
+        controller_mutex->unlock();
+        co_await serveControllerRequests();
+    }
+    // The device was lost while we ran and init is waiting on us
+    if (open) openDevice(open);
+    result.dubs = ctx.stats.dub_time.count - dub_start.count;
+    result.dub_ns = ctx.stats.dub_time.total_ns - dub_start.total_ns;
+    co_return result;
+}
+
+RDMTask<UIDList> OpenRDMDevice::fullDiscovery() {
     lost = UIDList();
     proxies = UIDList();
 
     bool NA = false;
-    sendMute(RDM_UID_BROADCAST, true, NA); // Unmute everything
-    tod = discover(0, RDM_UID_MAX);
+    co_await sendMute(RDM_UID_BROADCAST, true, NA); // Unmute everything
+    tod = co_await discover(0, RDM_UID_MAX);
 
     if (verbose) {
         for (auto &uid : tod) printf("RDM Device Discovered: %06lx\n", uid);
     }
 
-    discovery_in_progress = false;
-    return tod;
+    co_return tod;
 }
 
-std::pair<UIDList, UIDList> OpenRDMDevice::incrementalRDMDiscovery() {
-    if (!initialized) return std::make_pair(UIDList(), UIDList());
-    if (discovery_in_progress || !rdm_enabled) return std::make_pair(UIDList(), UIDList());
-    discovery_in_progress = true;
+RDMTask<std::pair<UIDList, UIDList>> OpenRDMDevice::incrementalDiscovery() {
     auto found = UIDList();
     auto new_lost = UIDList();
     auto new_proxies = UIDList();
     bool NA;
-    sendMute(RDM_UID_BROADCAST, true, NA); // Unmute everything
+    co_await sendMute(RDM_UID_BROADCAST, true, NA); // Unmute everything
     // Check tod devices are still there and lost devices are still lost
     // This also mutes devices we know about
     for (auto &uid : tod) {
+        co_await pauseDiscovery();
         bool is_proxy = false;
-        if (!sendMute(uid, false, is_proxy)) {
+        if (!co_await sendMute(uid, false, is_proxy)) {
             new_lost.push_back(uid);
             auto proxies_pos = std::find(proxies.begin(), proxies.end(), uid);
             if (proxies_pos != proxies.end()) {
@@ -139,8 +567,9 @@ std::pair<UIDList, UIDList> OpenRDMDevice::incrementalRDMDiscovery() {
         }
     }
     for (auto &uid : lost) {
+        co_await pauseDiscovery();
         bool is_proxy = false;
-        if (sendMute(uid, false, is_proxy)) {
+        if (co_await sendMute(uid, false, is_proxy)) {
             found.push_back(uid);
             if (is_proxy) {
                 auto proxies_pos = std::find(proxies.begin(), proxies.end(), uid);
@@ -152,14 +581,15 @@ std::pair<UIDList, UIDList> OpenRDMDevice::incrementalRDMDiscovery() {
         }
     }
 
-    auto discovered = discover(0, RDM_UID_MAX);
+    auto discovered = co_await discover(0, RDM_UID_MAX);
     
     for (auto &proxy_uid : proxies) {
+        co_await pauseDiscovery();
         // If proxy is in new_proxies, don't bother checking if its TOD has changed as we want to scan anyway
         if (std::find(new_proxies.begin(), new_proxies.end(), proxy_uid) == new_proxies.end()) {
-            if (!hasProxyTODChanged(proxy_uid)) continue;
+            if (!co_await hasProxyTODChanged(proxy_uid)) continue;
         }
-        auto new_proxy_tod = getProxyTOD(proxy_uid);
+        auto new_proxy_tod = co_await getProxyTOD(proxy_uid);
         for (auto &uid : new_proxy_tod) {
             // Merge into discovered if unique and new
             if (std::find(discovered.begin(), discovered.end(), uid) == discovered.end()) {
@@ -202,11 +632,107 @@ std::pair<UIDList, UIDList> OpenRDMDevice::incrementalRDMDiscovery() {
         for (auto &uid : found) printf("RDM Device Discovered: %06lx\n", uid);
     }
 
-    discovery_in_progress = false;
-    return std::make_pair(found, new_lost);
+    co_return std::make_pair(found, new_lost);
+}
+
+// Searches start to end, a branch at a time so controller requests can be served in between
+RDMTask<UIDList> OpenRDMDevice::discover(UID start, UID end) {
+    auto &state = discovery_state;
+    state.branches.clear();
+    state.branches.emplace_back(start, end);
+    auto discovered = UIDList();
+    while (!state.branches.empty()) {
+        co_await pauseDiscovery();
+        auto [branch_start, branch_end] = state.branches.back();
+        state.branches.pop_back();
+        for (auto &uid : co_await discoverBranch(branch_start, branch_end)) {
+            // Merge unique uid's into discovered
+            if (std::find(discovered.begin(), discovered.end(), uid) == discovered.end()) {
+                discovered.push_back(uid);
+            }
+        }
+    }
+    co_return discovered;
+}
+
+// Serves any controller requests waiting on discovery, then restores the muted set if they
+// unmuted devices, returns true if discovery was paused
+RDMTask<bool> OpenRDMDevice::pauseDiscovery() {
+    controller_mutex->lock();
+    bool paused = !controller_requests.empty();
+    if (paused) rdm_stats.pauses++;
+    controller_mutex->unlock();
+    if (!paused) co_return false;
+
+    if (co_await serveControllerRequests()) {
+        // Mute what we've found again so it stays out of the search
+        controller_mutex->lock();
+        rdm_stats.remutes++;
+        controller_mutex->unlock();
+        auto muted = discovery_state.muted;
+        for (auto &mute_uid : muted) {
+            bool is_proxy = false;
+            co_await sendMute(mute_uid, false, is_proxy);
+        }
+    }
+    co_return true;
+}
+
+// Parks a transaction that got ACK_TIMER until its QUEUED_MESSAGE poll is due, serving controller
+// requests that would otherwise wait for discovery's next branch boundary in the meantime
+RDMTask<bool> OpenRDMDevice::waitAckTimer(UID dest, double delay_ms) {
+    uint64_t due_ns = monotonicNs() + (uint64_t)(delay_ms * 1e6);
+    auto timer = std::make_shared<RDMAckTimer>(RDMAckTimer{dest, nullptr});
+    controller_mutex->lock();
+    auto deferred = deferred_acks.emplace(due_ns, timer);
+    rdm_stats.ack_timers++;
+    controller_mutex->unlock();
+
+    while (monotonicNs() < due_ns && isInitialized()) {
+        co_await RDMAckWait{this, timer, due_ns};
+        if (co_await pauseDiscovery()) {
+            controller_mutex->lock();
+            rdm_stats.ack_timer_pauses++;
+            controller_mutex->unlock();
+        }
+    }
+
+    controller_mutex->lock();
+    deferred_acks.erase(deferred);
+    controller_mutex->unlock();
+    co_return true;
+}
+
+bool OpenRDMDevice::RDMAckWait::await_suspend(std::coroutine_handle<> h) {
+    std::lock_guard<std::mutex> lock(*dev->controller_mutex);
+    // Requests queued before we got here won't wake us, serve them now
+    if (!dev->controller_requests.empty()) return false;
+    timer->waiter = h;
+    dev->actor->submitAt(OpenRDMPriority::RDM, due_ns, [dev = dev, timer = timer] { dev->resumeAckTimer(timer); });
+    return true;
+}
+
+// Call with controller_mutex held
+void OpenRDMDevice::wakeAckTimers() {
+    for (auto &deferred : deferred_acks) {
+        auto timer = deferred.second;
+        if (timer->waiter) actor->submit(OpenRDMPriority::RDM, [this, timer] { resumeAckTimer(timer); });
+    }
+}
+
+// Only call from the actor's thread, whichever of the due time and a controller request comes
+// first resumes the waiter, the other finds it gone
+void OpenRDMDevice::resumeAckTimer(std::shared_ptr<RDMAckTimer> timer) {
+    controller_mutex->lock();
+    auto waiter = timer->waiter;
+    timer->waiter = nullptr;
+    controller_mutex->unlock();
+    if (waiter) waiter.resume();
 }
 
-UIDList OpenRDMDevice::discover(UID start, UID end) {
+// Returns the device found in a branch, and any it proxies. On a collision the branch is split
+// onto the stack instead
+RDMTask<UIDList> OpenRDMDevice::discoverBranch(UID start, UID end) {
     UID mute_uid = start;
     if (start != end) {
         auto disc_msg_data = RDMPacketData();
@@ -218,14 +744,11 @@ UIDList OpenRDMDevice::discover(UID start, UID end) {
         size_t msg_len = disc_msg.writePacket(disc_msg_packet);
 
         auto response = RDMData();
-        this->dev_mutex->lock();
-        int resp_len = writeRDMOpenRDM(verbose, &ftdi,
-            disc_msg_packet.begin(), msg_len, true, true, response.begin(), ftdi_description.c_str());
-        this->dev_mutex->unlock();
+        int resp_len = co_await asyncRDM(disc_msg_packet.begin(), msg_len, true, true, response.begin());
         if (resp_len <= 0) { // Error occurred or no data
             // -666: USB device unavailable, wait a bit to avoid spam
-            if (resp_len == -666) std::this_thread::sleep_for(std::chrono::seconds(1));
-            return UIDList();
+            if (resp_len == -666) co_await delayRDM(1000);
+            co_return UIDList();
         }
 
         if (this->rdm_debug) {
@@ -243,44 +766,39 @@ UIDList OpenRDMDevice::discover(UID start, UID end) {
             }
             uint64_t lower_half_size = (end-start+1) / 2; // Start and end inclusive
             UID lower_half_max = start+lower_half_size-1; // Start inclusive
-            auto lower_half = discover(start, lower_half_max);
-            auto upper_half = discover(lower_half_max+1, end);
-            for (auto &uid : upper_half) {
-                // Merge unique uid's into lower_half
-                if (std::find(lower_half.begin(), lower_half.end(), uid) == lower_half.end()) {
-                    lower_half.push_back(uid);
-                }
-            }
-            return lower_half;
+            // Lower half goes on last so it is searched first
+            discovery_state.branches.emplace_back(lower_half_max+1, end);
+            discovery_state.branches.emplace_back(start, lower_half_max);
+            co_return UIDList();
         }
         mute_uid = resp.getUID();
     }
     bool is_proxy = false;
     // If we don't get a mute response, there is no device with that uid
-    if (!sendMute(mute_uid, false, is_proxy)) return UIDList();
+    if (!co_await sendMute(mute_uid, false, is_proxy)) co_return UIDList();
     auto discovered_uids = UIDList();
     discovered_uids.push_back(mute_uid);
 
-    if (!is_proxy) return discovered_uids;
+    if (!is_proxy) co_return discovered_uids;
 
-    for (auto &uid : getProxyTOD(mute_uid)) {
+    for (auto &uid : co_await getProxyTOD(mute_uid)) {
         // Merge unique uid's from proxy into discovered_uids
         if (std::find(discovered_uids.begin(), discovered_uids.end(), uid) == discovered_uids.end()) {
             discovered_uids.push_back(uid);
         }
     }
 
-    return discovered_uids;
+    co_return discovered_uids;
 }
 
-UIDList OpenRDMDevice::getProxyTOD(UID addr) {
+RDMTask<UIDList> OpenRDMDevice::getProxyTOD(UID addr) {
     auto proxy_tod_msg = RDMPacket(addr, uid, rdm_transaction_number++, 0x1, 0, 0,
         RDM_CC_GET_COMMAND, RDM_PID_PROXIED_DEVICES, 0, RDMPacketData());
 
     auto proxy_tod = UIDList();
     
-    auto resp = sendRDMPacket(proxy_tod_msg);
-    if (resp.size() == 0) return proxy_tod;
+    auto resp = co_await sendRDMPacket(proxy_tod_msg);
+    if (resp.size() == 0) co_return proxy_tod;
 
     for (auto &r : resp) {
         if (r.pdl > 0xe4) continue;
@@ -288,21 +806,21 @@ UIDList OpenRDMDevice::getProxyTOD(UID addr) {
             proxy_tod.push_back(getUID(&r.pdata[i]));
     }
 
-    return proxy_tod;
+    co_return proxy_tod;
 }
 
-bool OpenRDMDevice::hasProxyTODChanged(UID addr) {
+RDMTask<bool> OpenRDMDevice::hasProxyTODChanged(UID addr) {
     auto proxy_tod_changed_msg = RDMPacket(addr, uid, rdm_transaction_number++, 0x1, 0, 0,
         RDM_CC_GET_COMMAND, RDM_PID_PROXY_DEV_COUNT, 0, RDMPacketData());
 
-    auto resp = sendRDMPacket(proxy_tod_changed_msg);
-    if (resp.size() == 0) return false;
-    if (resp[0].pdl != 0x03) return false;
+    auto resp = co_await sendRDMPacket(proxy_tod_changed_msg);
+    if (resp.size() == 0) co_return false;
+    if (resp[0].pdl != 0x03) co_return false;
     
-    return resp[0].pdata[2] != 0;
+    co_return resp[0].pdata[2] != 0;
 }
 
-bool OpenRDMDevice::sendMute(UID addr, bool unmute, bool &is_proxy) {
+RDMTask<bool> OpenRDMDevice::sendMute(UID addr, bool unmute, bool &is_proxy) {
     auto mute_msg = RDMPacket(addr, uid, rdm_transaction_number++, 0x1, 0, 0,
         RDM_CC_DISCOVER, unmute ? RDM_PID_DISC_UNMUTE : RDM_PID_DISC_MUTE,
         0, RDMPacketData());
@@ -311,9 +829,16 @@ bool OpenRDMDevice::sendMute(UID addr, bool unmute, bool &is_proxy) {
         else printf("Sending MUTE to %06lx\n", addr);
     }
 
-    auto resp = sendRDMPacket(mute_msg);
-    if (resp.size() == 0) return false;
-    if (resp[0].getSrc() != addr) return false;
+    auto resp = co_await sendRDMPacket(mute_msg);
+    auto &muted = discovery_state.muted;
+    if (unmute && addr == RDM_UID_BROADCAST) muted.clear();
+    if (resp.size() == 0) co_return false;
+    if (resp[0].getSrc() != addr) co_return false;
+    if (unmute) {
+        muted.erase(std::remove(muted.begin(), muted.end(), addr), muted.end());
+    } else if (std::find(muted.begin(), muted.end(), addr) == muted.end()) {
+        muted.push_back(addr);
+    }
 
     if (resp[0].pdl == 0x02 || resp[0].pdl == 0x08) {
         uint16_t control_field = ((uint16_t)resp[0].pdata[0] << 8) | (uint16_t)resp[0].pdata[1];
@@ -325,52 +850,76 @@ bool OpenRDMDevice::sendMute(UID addr, bool unmute, bool &is_proxy) {
         else printf("MUTE Response from %06lx\n", addr);
     }
 
-    return true;
+    co_return true;
 }
 
-std::vector<RDMPacket> OpenRDMDevice::sendRDMPacket(RDMPacket pkt, unsigned int retries, double max_time_ms) {
+// retries and max_time_ms are limits, a responder with a history of answering first time gets
+// fewer retries for missing responses and a retry delay of its own timeout
+RDMTask<std::vector<RDMPacket>> OpenRDMDevice::sendRDMPacket(RDMPacket pkt, unsigned int retries, double max_time_ms) {
     auto resp_packets = std::vector<RDMPacket>();
     double retry_time_ms = max_time_ms;
     auto msg = RDMData();
+    unsigned int misses = 0, max_misses = retries;
+    double retry_delay_ms = RDM_RETRY_DELAY_MS;
+    if (pkt.hasRx()) {
+        controller_mutex->lock();
+        auto it = uid_stats.find(pkt.getDest());
+        if (it != uid_stats.end() && it->second.timeoutUs() > 0) {
+            max_misses = it->second.maxRetries(retries);
+            retry_delay_ms = it->second.timeoutUs() / 1e3;
+        }
+        controller_mutex->unlock();
+    }
+    // Counts a missing or bad response, returns true if it's worth retrying
+    auto retry_miss = [&] {
+        if (++misses > max_misses) return false;
+        if (!pkt.hasRx()) return true;
+        std::lock_guard<std::mutex> lock(*controller_mutex);
+        auto &stats = uid_stats[pkt.getDest()];
+        if (stats.quarantined) return false; // Retries would only be answered locally
+        stats.retries++;
+        return true;
+    };
 
-    auto t_start = std::chrono::high_resolution_clock::now();
+    uint64_t t_start = monotonicNs();
     auto pkt_pid = pkt.pid;
 
     // Don't count first try as a retry
     bool delay_tx = false;
     for (unsigned int pkt_try = 0; pkt_try <= retries; pkt_try++) {
-        if (delay_tx) std::this_thread::sleep_for(std::chrono::milliseconds(RDM_RETRY_DELAY_MS));
+        if (delay_tx) co_await delayRDM(retry_delay_ms);
         delay_tx = true;
         if (pkt_try != 0) {
             pkt.transaction_number = rdm_transaction_number++;
         }
         size_t msg_len = pkt.writePacket(msg);
-        auto t_now = std::chrono::high_resolution_clock::now();
-        double elapsed_time_ms = std::chrono::duration<double, std::milli>(t_now-t_start).count();
+        double elapsed_time_ms = (monotonicNs() - t_start) / 1e6;
         if (pkt_try > 0 && elapsed_time_ms > max_time_ms) break;
 
         auto response = RDMData();
-        this->dev_mutex->lock();
-        int resp_len = writeRDMOpenRDM(verbose, &ftdi,
-            msg.begin(), msg_len, false, pkt.hasRx(), response.begin(), ftdi_description.c_str());
-        this->dev_mutex->unlock();
+        int resp_len = co_await asyncRDM(msg.begin(), msg_len, false, pkt.hasRx(), response.begin());
         if (resp_len < 0) { // Error occurred
             // -666: USB device unavailable, wait a bit to avoid spam
-            if (resp_len == -666) std::this_thread::sleep_for(std::chrono::seconds(1));
-            return std::vector<RDMPacket>();
+            if (resp_len == -666) co_await delayRDM(1000);
+            co_return std::vector<RDMPacket>();
         }
         
         if (resp_len == 0) {
             // Don't retry for response if its a broadcast message
             if (!pkt.hasRx()) break;
             // Retry for response
+            if (!retry_miss()) break;
             continue;
         }
 
         auto resp = RDMPacket(uid, response, resp_len);
-        if (!resp.isValid()) continue;
-        if (resp.transaction_number != pkt.transaction_number) continue; // Check transaction numbers's match
-        if (resp.pid != pkt_pid) continue; // Check PID is correct (so we ignore stray queued messages)
+        bool matches = resp.isValid()
+            && resp.transaction_number == pkt.transaction_number // Check transaction numbers's match
+            && resp.pid == pkt_pid; // Check PID is correct (so we ignore stray queued messages)
+        if (!matches) {
+            if (!retry_miss()) break;
+            continue;
+        }
 
         if (resp.cc == RDM_CC_DISCOVER_RESP || pkt.cc == RDM_CC_DISCOVER) {
             if (resp.getRespType() == RDM_RESP_ACK) {
@@ -381,7 +930,7 @@ std::vector<RDMPacket> OpenRDMDevice::sendRDMPacket(RDMPacket pkt, unsigned int
             switch (resp.getRespType()) {
                 case RDM_RESP_ACK:
                     resp_packets.push_back(resp);
-                    return resp_packets;
+                    co_return resp_packets;
                 case RDM_RESP_ACK_OVERFL:
                     resp_packets.push_back(resp);
                     break;
@@ -392,7 +941,7 @@ std::vector<RDMPacket> OpenRDMDevice::sendRDMPacket(RDMPacket pkt, unsigned int
                     pkt.pid = RDM_PID_QUEUED_MESSAGE;
                     pkt.pdl = 1;
                     pkt.pdata[0] = RDM_STATUS_ERROR;
-                    std::this_thread::sleep_for(std::chrono::milliseconds(1)*std::min(max_time_ms, retry_time_ms));
+                    co_await waitAckTimer(pkt.getDest(), std::min(max_time_ms, retry_time_ms));
                     delay_tx = false;
                     break;
                 case RDM_RESP_NACK:
@@ -401,5 +950,5 @@ std::vector<RDMPacket> OpenRDMDevice::sendRDMPacket(RDMPacket pkt, unsigned int
         }
     }
 
-    return resp_packets;
+    co_return resp_packets;
 }
\ No newline at end of file
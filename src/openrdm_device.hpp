@@ -3,44 +3,220 @@
 #define __OPENRDM_DEVICE_HPP__
 
 #define RDM_RETRY_DELAY_MS 20
+// How long controller requests are dropped for after the device has gone, to avoid error spam
+#define RDM_ERROR_BACKOFF_MS 1000
+// Responses a UID needs to have sent before its timeout and retries are derived from them
+#define RDM_UID_MIN_SAMPLES 4
+// Shortest response timeout given to a UID, the request, turnaround and read latency all count
+#define RDM_UID_TIMEOUT_MIN_US 3000
+// Transactions a UID has to miss in a row before requests to it are answered locally
+#define RDM_QUARANTINE_MISSES 3
+// How often a quarantined UID still gets a request through, to see if it's back
+#define RDM_QUARANTINE_PROBE_MS 1000
+// How often a driven device checks whether the last frame's USB transfer has completed, before starting the next
+#define DMX_TRANSFER_POLL_US 100
 
 #include <string>
 #include <vector>
+#include <atomic>
+#include <coroutine>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <pthread.h>
 
 #include "openrdm.h"
+#include "openrdm_device_actor.hpp"
 #include "rdm.hpp"
+#include "rdm_task.hpp"
 
 typedef std::vector<UID> UIDList;
 
+struct RDMDiscoveryResult {
+    UIDList added, removed; // A full discovery only adds, its result is the whole TOD
+    uint64_t dubs = 0; // Discovery unique branch transactions sent, and their total time
+    uint64_t dub_ns = 0;
+};
+
+struct RDMDiscoveryStats {
+    uint64_t pauses = 0; // Branch boundaries where discovery stopped to serve controller requests
+    uint64_t remutes = 0; // Times the muted set was muted again after a controller unmuted devices
+    struct openrdm_interval_stats controller_latency = {}; // Controller requests made while discovery was running
+    uint64_t ack_timers = 0; // ACK_TIMER responses parked until their QUEUED_MESSAGE poll is due
+    uint64_t ack_timer_pauses = 0; // Times controller requests were served while one was parked
+    uint64_t ack_timers_pending = 0;
+};
+
+// Response times of one responder, its timeout and retries are derived from them
+struct RDMUIDStats {
+    uint64_t requests = 0; // Transactions sent to it expecting a response
+    uint64_t responses = 0;
+    uint64_t retries = 0; // Requests sendRDMPacket sent again after a missing or bad response
+    struct openrdm_interval_stats response_time = {};
+    double srtt_us = 0; // Smoothed response time and its mean deviation, estimated as TCP does for RTT
+    double rttvar_us = 0;
+    unsigned int consecutive_misses = 0;
+    // After RDM_QUARANTINE_MISSES in a row requests are answered locally with a timeout, apart from
+    // a probe every RDM_QUARANTINE_PROBE_MS and mutes, until it answers one
+    bool quarantined = false;
+    uint64_t quarantines = 0;
+    uint64_t next_probe_ns = 0;
+    uint64_t probes = 0;
+    uint64_t skipped = 0; // Requests answered locally
+    uint64_t miss_ns = 0; // Bus time the last missed transaction took
+    uint64_t saved_ns = 0; // Bus time the skipped requests would have taken, going by miss_ns
+    unsigned int timeoutUs() const; // 0 until there are enough responses to go on
+    unsigned int maxRetries(unsigned int retries) const; // Retries for missed responses, cut from retries for responders that rarely miss
+};
+typedef std::map<UID, RDMUIDStats> RDMUIDStatsMap;
+
 class OpenRDMDevice {
     public:
         bool verbose, rdm_enabled, rdm_debug;
         OpenRDMDevice();
         OpenRDMDevice(std::string ftdi_description, bool verbose, bool rdm_enabled, bool rdm_debug);
         bool init();
+        // Opening runs on the actor, startInit returns false if it already is and pollInit has
+        // the result once it is done, or waits for it if block is true
+        bool startInit();
+        std::optional<bool> pollInit(bool block = false);
         void deinit();
         bool isInitialized();
         std::string getDescription();
+        void setOptions(const struct openrdm_options &options);
+        uint64_t getFrameTimeNs(); // Time the last frame written takes on the line
+        uint64_t getTimedBreakNs(); // When the break of the last frame written with a start time started
+        struct openrdm_stats getStats();
+        std::future<struct openrdm_stats> requestStats(); // getStats without waiting for the actor
+        OpenRDMQueueStats getQueueStats();
+        int getBusNumber();
+        pthread_t getThreadHandle(); // The actor thread every USB transfer for the device runs on
+        // Give up the actor thread, for a reactor to run the device's commands instead. Call before init,
+        // wake is called whenever the device has something for runQueued to do
+        void drive(std::function<void()> wake);
+        bool runQueued(OpenRDMPriority lowest);
+        uint64_t nextTimerNs(); // When runQueued next has a timed command to run
+        std::optional<std::vector<struct pollfd>> getPollFds(); // nullopt while the device is busy
+        void handleEvents();
         static void findDevices(bool verbose);
-        void writeDMX(uint8_t *data, int len);
+        bool waitDMX(bool block = true);
+        void writeDMX(uint8_t *data, int len, uint64_t start_ns = 0);
         std::pair<int, RDMData> writeRDM(uint8_t *data, int len);
-        UIDList fullRDMDiscovery(); // Returns full TOD
-        std::pair<UIDList, UIDList> incrementalRDMDiscovery(); // Returns pair: added devices, removed devices
+        // Discovery runs in the background and returns false if one already is, done is
+        // called once pollRDMDiscovery has the result
+        bool startFullRDMDiscovery(std::function<void()> done);
+        bool startIncrementalRDMDiscovery(std::function<void()> done);
+        std::optional<RDMDiscoveryResult> pollRDMDiscovery();
+        RDMDiscoveryStats getRDMStats();
+        RDMUIDStatsMap getUIDStats();
     protected:
-        UIDList discover(UID start, UID end);
-        UIDList getProxyTOD(UID addr);
-        bool hasProxyTODChanged(UID addr);
-        bool sendMute(UID addr, bool unmute, bool &is_proxy);
-        std::vector<RDMPacket> sendRDMPacket(RDMPacket pkt, unsigned int retries = 5, double max_time_ms = 2000);
+        // Coroutines run on the device's actor, suspending for every transaction and delay
+        RDMTask<UIDList> discover(UID start, UID end);
+        RDMTask<UIDList> discoverBranch(UID start, UID end);
+        RDMTask<bool> serveControllerRequests();
+        RDMTask<bool> pauseDiscovery();
+        RDMTask<bool> waitAckTimer(UID dest, double delay_ms);
+        RDMTask<UIDList> getProxyTOD(UID addr);
+        RDMTask<bool> hasProxyTODChanged(UID addr);
+        RDMTask<bool> sendMute(UID addr, bool unmute, bool &is_proxy);
+        RDMTask<std::vector<RDMPacket>> sendRDMPacket(RDMPacket pkt, unsigned int retries = 5, double max_time_ms = 2000);
     private:
-        bool initialized = false;
-        bool discovery_in_progress;
-        struct ftdi_context ftdi;
+        // Resumes the awaiting coroutine from its own actor command once the transaction is done
+        struct RDMTransaction {
+            OpenRDMDevice *dev;
+            uint8_t *data;
+            int len;
+            bool is_discover, has_rx;
+            uint8_t *rx_data;
+            int result = 0;
+            bool await_ready() { return false; }
+            void await_suspend(std::coroutine_handle<> h);
+            int await_resume() { return result; }
+        };
+        // Resumes the awaiting coroutine after delay_ms without holding up the actor
+        struct RDMDelay {
+            OpenRDMDevice *dev;
+            double delay_ms;
+            bool await_ready() { return delay_ms <= 0; }
+            void await_suspend(std::coroutine_handle<> h);
+            void await_resume() {}
+        };
+        // A transaction parked after ACK_TIMER, waiter is set while its coroutine is suspended
+        struct RDMAckTimer {
+            UID dest;
+            std::coroutine_handle<> waiter;
+        };
+        // Resumes the awaiting coroutine at due_ns, or earlier once a controller request is queued.
+        // Only holds references, as temporaries in co_await expressions don't always get destroyed once
+        struct RDMAckWait {
+            OpenRDMDevice *dev;
+            const std::shared_ptr<RDMAckTimer> &timer;
+            uint64_t due_ns;
+            bool await_ready() { return false; }
+            bool await_suspend(std::coroutine_handle<> h);
+            void await_resume() {}
+        };
+        void resumeAckTimer(std::shared_ptr<RDMAckTimer> timer);
+        void wakeAckTimers();
+        RDMTransaction asyncRDM(uint8_t *data, int len, bool is_discover, bool has_rx, uint8_t *rx_data);
+        RDMDelay delayRDM(double delay_ms);
+        // A controller request made while discovery runs, served at the next branch boundary
+        struct RDMControllerRequest {
+            uint8_t *data;
+            int len;
+            bool has_rx;
+            uint8_t *rx_data;
+            bool unmutes; // DISC_UNMUTE, so the muted set has to be muted again
+            std::promise<int> result;
+        };
+        // Discovery is a depth first search over branches of the UID space, kept here so it survives pauses
+        struct RDMDiscoveryState {
+            std::vector<std::pair<UID, UID>> branches; // Branches still to search, the next one last
+            UIDList muted; // Muted since the last broadcast unmute
+        };
+        template <typename T> std::future<T> startRDM(RDMTask<T> task, std::function<void()> done);
+        bool startDiscovery(bool incremental, std::function<void()> done);
+        RDMTask<RDMDiscoveryResult> runDiscovery(bool incremental);
+        RDMTask<UIDList> fullDiscovery();
+        RDMTask<std::pair<UIDList, UIDList>> incrementalDiscovery();
+        int controllerRDM(uint8_t *data, int len, bool has_rx, uint8_t *rx_data, bool unmutes);
+        int runTransaction(uint8_t *data, int len, bool is_discover, bool has_rx, uint8_t *rx_data);
+        int transactRDM(uint8_t *data, int len, bool is_discover, bool has_rx, uint8_t *rx_data);
+        void openDevice(std::shared_ptr<std::promise<bool>> result);
+        void closeDevice();
+        void startDMX(uint8_t *data, int len, uint64_t start_ns, std::shared_ptr<std::promise<void>> sent);
+        void finishDMX(std::shared_ptr<std::promise<void>> sent);
+        void checkDMX(int ret);
+        bool admitUIDRequest(UID dest, bool is_mute, unsigned int &timeout_us);
+        void recordUIDResponse(UID dest, int ret, uint64_t response_ns, uint64_t transaction_ns);
+        // Set on the actor's thread, read from any, so the device state it guards is seen with it
+        std::unique_ptr<std::atomic<bool>> initialized;
+        struct openrdm_context ctx;
         std::string ftdi_description;
         UID uid;
         uint8_t rdm_transaction_number = 0;
         UIDList tod, lost, proxies;
-        std::unique_ptr<std::mutex> dev_mutex;
+        RDMDiscoveryState discovery_state; // Only used on the actor's thread
+        std::future<RDMDiscoveryResult> discovery_result;
+        std::unique_ptr<std::mutex> controller_mutex; // Guards the controller request queue, discovery_running, pending_open, rdm_stats, uid_stats and deferred_acks
+        std::deque<RDMControllerRequest*> controller_requests;
+        bool discovery_running = false;
+        std::shared_ptr<std::promise<bool>> pending_open; // An init waiting for discovery to return
+        RDMDiscoveryStats rdm_stats;
+        RDMUIDStatsMap uid_stats;
+        std::multimap<uint64_t, std::shared_ptr<RDMAckTimer>> deferred_acks; // Responders that sent ACK_TIMER, by when to poll them
+        std::future<bool> init_result; // Queued open of the device
+        uint64_t rdm_backoff_ns = 0; // writeRDM drops requests until then, only used by its caller
+        std::future<int> dmx_wait; // Queued wait for the last DMX frame to be sent
+        std::future<void> dmx_sent; // A driven write, ready once the frame has been handed to the device
+        bool driven = false;
+        std::unique_ptr<std::atomic<uint64_t>> frame_time_ns;
+        std::unique_ptr<std::atomic<uint64_t>> timed_break_ns;
+        std::unique_ptr<OpenRDMDeviceActor> actor; // Owns ctx, every operation on it runs on the actor's thread
 };
 
 #endif // __OPENRDM_DEVICE_HPP__
\ No newline at end of file
@@ -0,0 +1,221 @@
+#ifndef __OPENRDM_DEVICE_ACTOR_HPP__
+#define __OPENRDM_DEVICE_ACTOR_HPP__
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "openrdm_clock.hpp"
+
+enum class OpenRDMPriority {
+    DMX = 0, // DMX frames and device control, run before anything queued at a lower priority
+    RDM = 1, // One RDM transaction per command, so DMX can go out between them
+};
+
+#define OPENRDM_PRIORITIES 2
+
+struct OpenRDMQueueStats {
+    std::array<uint64_t, OPENRDM_PRIORITIES> depth = {}; // Commands waiting to run
+    std::array<uint64_t, OPENRDM_PRIORITIES> depth_max = {};
+    std::array<struct openrdm_interval_stats, OPENRDM_PRIORITIES> wait = {}; // Time from queueing to running
+};
+
+// Owns a device and runs every operation on it from a single thread, so the device context
+// needs no lock. Commands run to completion in priority order, then in the order they were queued.
+// A driven actor has no thread of its own: whoever is waiting on it runs its commands, and
+// runQueued lets the threads of a reactor run them between their other work
+class OpenRDMDeviceActor {
+    public:
+        ~OpenRDMDeviceActor() {
+            queue_mutex.lock();
+            stop = true;
+            queue_mutex.unlock();
+            queue_cv.notify_all();
+            if (thread.joinable()) thread.join();
+        }
+
+        // Call before anything is queued, wake is called whenever a command is queued
+        void drive(std::function<void()> wake) {
+            this->wake = std::move(wake);
+            driven = true;
+        }
+
+        // Queue fn to run on the owner thread, the returned future completes with its result
+        template <typename F>
+        auto submit(OpenRDMPriority priority, F &&fn) -> std::future<decltype(fn())> {
+            return submitAt(priority, 0, std::forward<F>(fn));
+        }
+
+        // Queue fn once the monotonic clock reaches run_ns, so waits don't hold up other commands
+        template <typename F>
+        auto submitAt(OpenRDMPriority priority, uint64_t run_ns, F &&fn) -> std::future<decltype(fn())> {
+            auto task = std::make_shared<std::packaged_task<decltype(fn())()>>(std::forward<F>(fn));
+            auto result = task->get_future();
+            size_t p = static_cast<size_t>(priority);
+            queue_mutex.lock();
+            // The thread is started on first use, so unused ports don't cost a thread
+            if (!driven && !thread.joinable()) thread = std::thread(&OpenRDMDeviceActor::run, this);
+            uint64_t now = monotonicNs();
+            auto command = Command{[task] { (*task)(); }, std::max(run_ns, now)};
+            if (run_ns > now) {
+                timers.emplace(run_ns, std::make_pair(p, std::move(command)));
+            } else {
+                enqueue(p, std::move(command));
+            }
+            queue_mutex.unlock();
+            queue_cv.notify_all();
+            if (driven) wake();
+            return result;
+        }
+
+        // Run fn on the owner thread and wait for its result
+        template <typename F>
+        auto call(OpenRDMPriority priority, F &&fn) -> decltype(fn()) {
+            auto result = submit(priority, std::forward<F>(fn));
+            wait(result);
+            return result.get();
+        }
+
+        // Wait for a command's result, running the queued commands meanwhile if the actor is driven
+        template <typename T>
+        void wait(std::future<T> &result) {
+            if (!driven) {
+                blockOnClock([&] { result.wait(); });
+                return;
+            }
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            while (result.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                if (running || !runNext(lock, OpenRDMPriority::RDM)) idle(lock);
+            }
+        }
+
+        // Runs a driven actor's DMX commands queued before the call, and one RDM command if lowest is RDM,
+        // unless another thread is running one. Commands they queue wait for the next call, so a thread
+        // driving several actors gets round all of them first. Returns true if commands are still
+        // queued at those priorities
+        bool runQueued(OpenRDMPriority lowest) {
+            if (!driven) return false;
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            if (running) return false;
+            uint64_t called_ns = monotonicNs();
+            while (runNext(lock, OpenRDMPriority::DMX, called_ns));
+            if (lowest == OpenRDMPriority::RDM && runNext(lock, OpenRDMPriority::RDM, called_ns)) {
+                while (runNext(lock, OpenRDMPriority::DMX, called_ns));
+            }
+            bool more = false;
+            for (size_t p = 0; p <= static_cast<size_t>(lowest); p++) more |= !queues[p].empty();
+            return more;
+        }
+
+        // Runs fn straight away if no command is running, for work that can be skipped while the device is busy
+        template <typename F>
+        bool tryRun(F &&fn) {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            if (running) return false;
+            running = true;
+            lock.unlock();
+            fn();
+            lock.lock();
+            running = false;
+            // Commands queued meanwhile on an actor with a thread are left to it
+            if (driven) while (runNext(lock, OpenRDMPriority::DMX));
+            queue_cv.notify_all();
+            return true;
+        }
+
+        // When the earliest timed command is due, UINT64_MAX if there is none
+        uint64_t nextTimerNs() {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            return timers.empty() ? UINT64_MAX : timers.begin()->first;
+        }
+
+        OpenRDMQueueStats getStats() {
+            queue_mutex.lock();
+            auto queue_stats = stats;
+            queue_mutex.unlock();
+            return queue_stats;
+        }
+
+    private:
+        struct Command {
+            std::function<void()> fn;
+            uint64_t queued_ns;
+        };
+
+        // Call with queue_mutex held
+        void enqueue(size_t p, Command command) {
+            queues[p].push_back(std::move(command));
+            stats.depth[p] = queues[p].size();
+            if (stats.depth[p] > stats.depth_max[p]) stats.depth_max[p] = stats.depth[p];
+        }
+
+        // Runs the next command at or above lowest priority queued by queued_by_ns, returns false if there
+        // was none. Call with lock held on queue_mutex, it is released while the command runs
+        bool runNext(std::unique_lock<std::mutex> &lock, OpenRDMPriority lowest, uint64_t queued_by_ns = UINT64_MAX) {
+            // Timed commands join their queue once due, their wait is counted from then
+            uint64_t now = monotonicNs();
+            while (!timers.empty() && timers.begin()->first <= std::min(now, queued_by_ns)) {
+                auto timer = timers.begin();
+                enqueue(timer->second.first, std::move(timer->second.second));
+                timers.erase(timer);
+            }
+            size_t p = 0;
+            while (p <= static_cast<size_t>(lowest) && queues[p].empty()) p++;
+            if (p > static_cast<size_t>(lowest) || queues[p].front().queued_ns > queued_by_ns) return false;
+            auto command = std::move(queues[p].front());
+            queues[p].pop_front();
+            stats.depth[p] = queues[p].size();
+            recordInterval(&stats.wait[p], monotonicNs() - command.queued_ns);
+            running = true;
+            lock.unlock();
+            command.fn();
+            lock.lock();
+            running = false;
+            // Waiters on a driven actor check their result whenever a command finishes
+            if (driven) queue_cv.notify_all();
+            return true;
+        }
+
+        // Waits for a command to be queued or the next timer, call with lock held on queue_mutex
+        void idle(std::unique_lock<std::mutex> &lock) {
+            if (timers.empty()) {
+                blockOnClock([&] { queue_cv.wait(lock); });
+            } else {
+                waitOnClock(timers.begin()->first, [&](auto timeout) {
+                    return queue_cv.wait_for(lock, timeout) == std::cv_status::no_timeout;
+                });
+            }
+        }
+
+        void run() {
+            attachThreadOpenRDM();
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            while (!stop) {
+                // tryRun may have a command running on another thread
+                if (running || !runNext(lock, OpenRDMPriority::RDM)) idle(lock);
+            }
+            lock.unlock();
+            detachThreadOpenRDM();
+        }
+
+        std::mutex queue_mutex; // Only held to queue and dequeue commands, never while one runs
+        std::condition_variable queue_cv;
+        std::array<std::deque<Command>, OPENRDM_PRIORITIES> queues;
+        std::multimap<uint64_t, std::pair<size_t, Command>> timers; // Commands waiting for their run time
+        OpenRDMQueueStats stats;
+        bool stop = false;
+        bool driven = false;
+        bool running = false; // A command is running, only one may at a time
+        std::function<void()> wake;
+        std::thread thread;
+};
+
+#endif // __OPENRDM_DEVICE_ACTOR_HPP__
@@ -2,8 +2,13 @@
 #ifndef __OPENRDM_DEVICE_THREAD_HPP__
 #define __OPENRDM_DEVICE_THREAD_HPP__
 
+#include <atomic>
+#include <chrono>
+
 #include "rdm.hpp"
 #include "dmx.h"
+#include "dmx_mailbox.hpp"
+#include "openrdm_timing.h"
 
 struct RDMMessage {
     int address;
@@ -11,10 +16,57 @@ struct RDMMessage {
     RDMData data;
 };
 
-struct DMXMessage {
-    bool changed;
+enum class ArtNetOutType {
+    RDM, // ArtRdm response to address
+    AddDevices, // UIDs discovered on port, length / RDM_UID_LENGTH of them
+    RemoveDevice, // UID lost from port
+};
+
+// Art-Net traffic from the RDM threads, sent by the thread that reads Art-Net
+struct ArtNetOutMessage {
+    ArtNetOutType type;
+    int address; // Universe address for RDM, port otherwise
     int length;
-    std::array<uint8_t, DMX_MAX_LENGTH> data;
+    RDMData data;
+    uint64_t queued_ns;
+};
+
+enum class DMXOutputMode {
+    Change, // Send frames when they change, refresh at the port's rate otherwise
+    Continuous, // Send frames back to back at the port's rate
+};
+
+struct DMXPortStats {
+    std::atomic<uint64_t> received = 0; // ArtDmx packets for the port
+    std::atomic<uint64_t> changed = 0; // Frames transmitted because they changed
+    std::atomic<uint64_t> deduplicated = 0; // Frames identical to the last one transmitted
+    std::atomic<uint64_t> open_attempts = 0; // Tries to reopen the device after losing it
+    std::atomic<uint64_t> reconnects = 0;
+    std::atomic<uint64_t> reconnect_last_ns = 0; // From losing the device to having it open again
+    std::atomic<uint64_t> reconnect_max_ns = 0;
+};
+
+// DMX output state of a port, owned by its DMX thread or the reactor
+struct DMXPortState {
+    bool port_ok = true;
+    bool continuous = false;
+    bool staggered = false;
+    uint64_t period_ns = 0;
+    uint64_t phase_origin_ns = 0; // Frames on a staggered port start on a grid from here
+    uint64_t next_frame_ns = 0;
+    uint64_t t_last_ns = 0; // Last frame transmitted
+    uint64_t reinit_ns = 0; // When to try reopening the device, 0 if not waiting to, UINT64_MAX to wait for a USB arrival
+    uint64_t disconnect_ns = 0; // When the device was lost
+    uint64_t arrivals_seen = 0; // USB hotplug counts as of the last attempt to open the device
+    uint64_t departures_seen = 0;
+    int open_retries = 0; // Quick retries left after a USB arrival
+    bool opening = false; // Waiting on the actor to open the device
+    DMXFrame last_tx; // Copy of the last frame transmitted, to detect consoles resending identical frames
+};
+
+struct RDMPortState {
+    uint64_t i_scan_last_ns = monotonicNs();
+    bool port_ok = true;
 };
 
 #endif // __OPENRDM_DEVICE_THREAD_HPP__
\ No newline at end of file
@@ -0,0 +1,171 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+
+#include "openrdm.h"
+#include "openrdm_transport.h"
+
+// libftdi transport, the line is driven from userspace through libusb
+
+static int ftdiOpen(int verbose, struct openrdm_context *ctx, const char *description) {
+    struct ftdi_context *ftdi = &ctx->ftdi;
+    ctx->tx_transfer = NULL;
+    int ret = ftdi_init(ftdi);
+    if (ret != 0) {
+        fprintf(stderr, "FTDI ERROR %d: %s\n", ret, ftdi->error_str);
+        return ret;
+    }
+
+    ret = ftdi_usb_open_string(ftdi, description);
+    if (ret != 0) {
+        fprintf(stderr, "FTDI ERROR %d: %s\n", ret, ftdi->error_str);
+        ftdi_deinit(ftdi);
+        return ret;
+    }
+    return 0;
+}
+
+static void ftdiClose(struct openrdm_context *ctx) {
+    struct ftdi_context *ftdi = &ctx->ftdi;
+    // Check we have usb device handle before we try to close it
+    if (ftdi->usb_dev) ftdi_usb_close(ftdi);
+    ftdi_deinit(ftdi);
+}
+
+static int ftdiReset(struct openrdm_context *ctx) {
+    struct ftdi_context *ftdi = &ctx->ftdi;
+    ftdi_usb_reset(ftdi);
+    ftdi_set_baudrate(ftdi, BAUDRATE);
+    ftdi_set_line_property(ftdi, BITS_8, STOP_BIT_2, NONE);
+    ftdi_setflowctrl(ftdi, SIO_DISABLE_FLOW_CTRL);
+    ftdi_set_latency_timer(ftdi, FTDI_LATENCY_TIMER_MS);
+    ftdi_read_data_set_chunksize(ftdi, FTDI_READ_CHUNK_SIZE);
+    ftdi_usb_purge_rx_buffer(ftdi);
+    ftdi_usb_purge_tx_buffer(ftdi);
+    ftdi->usb_write_timeout = 50;
+    return 0;
+}
+
+static int ftdiSetBreak(struct openrdm_context *ctx, int on) {
+    return ftdi_set_line_property2(&ctx->ftdi, BITS_8, STOP_BIT_2, NONE, on ? BREAK_ON : BREAK_OFF);
+}
+
+static int ftdiPurgeRx(struct openrdm_context *ctx) {
+    return ftdi_usb_purge_rx_buffer(&ctx->ftdi);
+}
+
+static int ftdiPurgeTx(struct openrdm_context *ctx) {
+    return ftdi_usb_purge_tx_buffer(&ctx->ftdi);
+}
+
+static int ftdiWrite(struct openrdm_context *ctx, unsigned char *data, int size) {
+    return ftdi_write_data(&ctx->ftdi, data, size);
+}
+
+static int ftdiSubmit(struct openrdm_context *ctx, unsigned char *data, int size) {
+#ifdef HAVE_LIBFTDI1
+    ctx->tx_transfer = ftdi_write_data_submit(&ctx->ftdi, data, size);
+    if (ctx->tx_transfer) return size;
+#endif
+    // Submit failed, use a blocking write so we get a proper error code
+    return ftdiWrite(ctx, data, size);
+}
+
+static int ftdiWait(struct openrdm_context *ctx) {
+    int ret = 0;
+#ifdef HAVE_LIBFTDI1
+    if (ctx->tx_transfer) {
+        ret = ftdi_transfer_data_done(ctx->tx_transfer);
+        ctx->tx_transfer = NULL;
+        if (ret > 0) ret = 0;
+    }
+#endif
+    return ret;
+}
+
+// libusb marks the transfer completed from handle_events, or from whoever else is handling its events
+static int ftdiDone(struct openrdm_context *ctx) {
+#ifdef HAVE_LIBFTDI1
+    return !ctx->tx_transfer || ctx->tx_transfer->completed;
+#else
+    return 1;
+#endif
+}
+
+static int ftdiRead(struct openrdm_context *ctx, unsigned char *data, int size, uint64_t deadline_ns) {
+    // libftdi returns on the first packet without data, which the device sends every latency
+    // timer period while the line is quiet, so keep reading until data has come and gone
+    int received = 0;
+    while (received < size) {
+        uint64_t now = monotonicNs();
+        if (now >= deadline_ns) break;
+        ctx->ftdi.usb_read_timeout = (int)((deadline_ns - now + 999999) / 1000000);
+        int ret = ftdi_read_data(&ctx->ftdi, data + received, size - received);
+        if (ret < 0) return ret;
+        if (ret == 0 && received > 0) break; // Line went quiet
+        received += ret;
+    }
+    return received;
+}
+
+static const char *ftdiErrorStr(struct openrdm_context *ctx) {
+    return ctx->ftdi.error_str;
+}
+
+static int ftdiBusNumber(struct openrdm_context *ctx) {
+#ifdef HAVE_LIBFTDI1
+    if (!ctx->ftdi.usb_dev) return -1;
+    libusb_device *dev = libusb_get_device(ctx->ftdi.usb_dev);
+    if (!dev) return -1;
+    return libusb_get_bus_number(dev);
+#else
+    return -1;
+#endif
+}
+
+static int ftdiPollFds(struct openrdm_context *ctx, struct pollfd *fds, int max) {
+#ifdef HAVE_LIBFTDI1
+    if (!ctx->ftdi.usb_ctx) return 0;
+    const struct libusb_pollfd **usb_fds = libusb_get_pollfds(ctx->ftdi.usb_ctx);
+    if (!usb_fds) return 0;
+    int count = 0;
+    for (; usb_fds[count] && count < max; count++) {
+        fds[count].fd = usb_fds[count]->fd;
+        fds[count].events = usb_fds[count]->events;
+        fds[count].revents = 0;
+    }
+    libusb_free_pollfds(usb_fds);
+    return count;
+#else
+    return 0;
+#endif
+}
+
+// Completes the callback of an asynchronous write, so waiting for it later doesn't block
+static void ftdiHandleEvents(struct openrdm_context *ctx) {
+#ifdef HAVE_LIBFTDI1
+    struct timeval zero = { 0, 0 };
+    libusb_handle_events_timeout_completed(ctx->ftdi.usb_ctx, &zero, NULL);
+#endif
+}
+
+const struct openrdm_transport openrdm_ftdi_transport = {
+    .name = "FTDI",
+    .open = ftdiOpen,
+    .close = ftdiClose,
+    .reset = ftdiReset,
+    .set_break = ftdiSetBreak,
+    .purge_rx = ftdiPurgeRx,
+    .purge_tx = ftdiPurgeTx,
+    .write = ftdiWrite,
+    .submit = ftdiSubmit,
+    .wait = ftdiWait,
+    .done = ftdiDone,
+    .read = ftdiRead,
+    .error_str = ftdiErrorStr,
+    .bus_number = ftdiBusNumber,
+    .poll_fds = ftdiPollFds,
+    .handle_events = ftdiHandleEvents,
+};
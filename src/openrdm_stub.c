@@ -0,0 +1,144 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdatomic.h>
+#include <string.h>
+
+#include "openrdm.h"
+#include "openrdm_transport.h"
+
+// Simulated transport, no device is opened and nothing responds on the line unless a test sets a responder
+
+// Simulated transport timings, roughly what an FT232R on a full speed hub achieves
+#define STUB_CONTROL_TRANSFER_US 1000
+#define STUB_USB_LATENCY_US 1000
+#define STUB_TX_FIFO_SIZE 256
+// Simulated devices all share one bus, where each transfer holds it for this long
+#define STUB_BUS_TRANSFER_US 250
+
+static _Atomic uint64_t stub_bus_free_ns;
+
+static openrdm_stub_responder stub_responder;
+static void *stub_responder_user;
+
+void setStubResponderOpenRDM(openrdm_stub_responder responder, void *user) {
+    stub_responder = responder;
+    stub_responder_user = user;
+}
+
+// Queue a transfer on the shared bus, returns how long it waits for the transfers ahead of it
+static uint64_t stubBusDelayNs(void) {
+    uint64_t now = monotonicNs();
+    uint64_t free_ns = atomic_load(&stub_bus_free_ns);
+    uint64_t start_ns;
+    do {
+        start_ns = free_ns > now ? free_ns : now;
+    } while (!atomic_compare_exchange_weak(&stub_bus_free_ns, &free_ns, start_ns + STUB_BUS_TRANSFER_US*1000ULL));
+    return start_ns - now;
+}
+
+// Bulk transfers complete once everything that doesn't fit in the FIFO is on the line
+static uint64_t stubTransferCompleteNs(int size) {
+    int queued = size > STUB_TX_FIFO_SIZE ? size - STUB_TX_FIFO_SIZE : 0;
+    uint64_t bus_delay_ns = stubBusDelayNs();
+    return monotonicNs() + bus_delay_ns + STUB_USB_LATENCY_US*1000ULL + (uint64_t)queued * DMX_SLOT_TIME_US * 1000;
+}
+
+static int stubOpen(int verbose, struct openrdm_context *ctx, const char *description) {
+    ctx->stub_usb_complete_ns = 0;
+    ctx->stub_rx_size = 0;
+    ctx->stub_rx_pos = 0;
+    return 0;
+}
+
+static void stubClose(struct openrdm_context *ctx) {
+}
+
+static int stubReset(struct openrdm_context *ctx) {
+    return 0;
+}
+
+static int stubControl(struct openrdm_context *ctx) {
+    uint64_t bus_delay_ns = stubBusDelayNs();
+    sleepUntilNs(monotonicNs() + bus_delay_ns + STUB_CONTROL_TRANSFER_US*1000ULL);
+    return 0;
+}
+
+static int stubSetBreak(struct openrdm_context *ctx, int on) {
+    return stubControl(ctx);
+}
+
+static int stubPurgeRx(struct openrdm_context *ctx) {
+    ctx->stub_rx_size = 0;
+    ctx->stub_rx_pos = 0;
+    return stubControl(ctx);
+}
+
+static int stubWrite(struct openrdm_context *ctx, unsigned char *data, int size) {
+    sleepUntilNs(stubTransferCompleteNs(size));
+    if (stub_responder && size > 0 && data[0] == RDM_START_CODE) {
+        uint64_t delay_ns = 0;
+        ctx->stub_rx_size = stub_responder(stub_responder_user, data, size, ctx->stub_rx_data, sizeof(ctx->stub_rx_data), &delay_ns);
+        ctx->stub_rx_pos = 0;
+        uint64_t sent_ns = ctx->tx_complete_ns > monotonicNs() ? ctx->tx_complete_ns : monotonicNs();
+        ctx->stub_rx_start_ns = sent_ns + delay_ns + STUB_USB_LATENCY_US*1000ULL;
+    }
+    return size;
+}
+
+static int stubSubmit(struct openrdm_context *ctx, unsigned char *data, int size) {
+    ctx->stub_usb_complete_ns = stubTransferCompleteNs(size);
+    return size;
+}
+
+static int stubWait(struct openrdm_context *ctx) {
+    sleepUntilNs(ctx->stub_usb_complete_ns);
+    return 0;
+}
+
+static int stubDone(struct openrdm_context *ctx) {
+    return monotonicNs() >= ctx->stub_usb_complete_ns;
+}
+
+// Reply bytes arrive a slot time apart, reads return what has arrived by the deadline
+static int stubRead(struct openrdm_context *ctx, unsigned char *data, int size, uint64_t deadline_ns) {
+    int left = ctx->stub_rx_size - ctx->stub_rx_pos;
+    uint64_t next_ns = ctx->stub_rx_start_ns + (uint64_t)(ctx->stub_rx_pos + 1) * DMX_SLOT_TIME_US * 1000;
+    if (left <= 0 || next_ns > deadline_ns) {
+        sleepUntilNs(deadline_ns);
+        return 0;
+    }
+    int n = size < left ? size : left;
+    uint64_t arrived = (deadline_ns - ctx->stub_rx_start_ns) / (DMX_SLOT_TIME_US * 1000) - ctx->stub_rx_pos;
+    if ((uint64_t)n > arrived) n = arrived;
+    sleepUntilNs(ctx->stub_rx_start_ns + (uint64_t)(ctx->stub_rx_pos + n) * DMX_SLOT_TIME_US * 1000);
+    memcpy(data, ctx->stub_rx_data + ctx->stub_rx_pos, n);
+    ctx->stub_rx_pos += n;
+    return n;
+}
+
+static const char *stubErrorStr(struct openrdm_context *ctx) {
+    return "Simulated device";
+}
+
+static int stubBusNumber(struct openrdm_context *ctx) {
+    return 0;
+}
+
+const struct openrdm_transport openrdm_stub_transport = {
+    .name = "Simulated",
+    .open = stubOpen,
+    .close = stubClose,
+    .reset = stubReset,
+    .set_break = stubSetBreak,
+    .purge_rx = stubPurgeRx,
+    .purge_tx = stubControl,
+    .write = stubWrite,
+    .submit = stubSubmit,
+    .wait = stubWait,
+    .done = stubDone,
+    .read = stubRead,
+    .error_str = stubErrorStr,
+    .bus_number = stubBusNumber,
+};
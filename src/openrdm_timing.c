@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "openrdm_timing.h"
+
+#define TIMING_CALIBRATION_SAMPLES 50
+#define TIMING_CALIBRATION_SLEEP_NS 100000 // 100us
+#define TIMING_SPIN_MARGIN_NS 20000 // 20us
+#define TIMING_SPIN_MAX_NS 2000000 // 2ms, don't burn more than this even on a badly loaded system
+#define SIM_CLOCK_START_NS 1000000000ULL // Simulated time starts at 1s, so a time of 0 still means unset
+#define SIM_CLOCK_QUIET_US 100 // Real time without any wait starting or ending before the simulated clock moves on
+#define SIM_CLOCK_SLICE_US 50 // Real time waits on other primitives block for between checks of the simulated clock
+#define SIM_CLOCK_MAX_WAITS 64
+
+// Spin for this long before a deadline, until calibrateTimingOpenRDM replaces it
+static uint64_t spin_threshold_ns = 200000;
+
+static uint64_t realNowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void realSleepUntilNs(uint64_t t) {
+    struct timespec ts;
+    ts.tv_sec = t / 1000000000ULL;
+    ts.tv_nsec = t % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+static void realWait(uint64_t t) {}
+
+static void realThread(void) {}
+
+const struct openrdm_clock openrdm_real_clock = {
+    .name = "real",
+    .start = NULL,
+    .now_ns = realNowNs,
+    .sleep_until_ns = realSleepUntilNs,
+    .begin_wait = realWait,
+    .end_wait = realWait,
+    .attach_thread = realThread,
+    .detach_thread = realThread,
+    .wait_slice_ns = 0,
+    .exact_sleep = 0,
+};
+
+// Simulated time is discrete events: it only moves forward when every attached thread is waiting
+// and has been for a while, and then jumps straight to the earliest time one of them is waiting for.
+// A thread busy working holds the clock, so work never appears to take less simulated time than it
+// lets other threads get done. Transfers on stub devices sleep on the clock, so they take simulated time too
+static pthread_mutex_t sim_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sim_cond = PTHREAD_COND_INITIALIZER;
+static _Atomic uint64_t sim_now_ns = SIM_CLOCK_START_NS;
+static uint64_t sim_waits[SIM_CLOCK_MAX_WAITS]; // Times threads are waiting for, guarded by sim_mutex
+static int sim_num_waits = 0;
+static uint64_t sim_activity = 0; // Waits started or ended, the clock only advances while it stands still
+static int sim_threads = 0; // Attached threads, and how many of them are waiting
+static int sim_blocked = 0;
+static _Thread_local int sim_attached = 0;
+
+// Call with sim_mutex held
+static void simAddWait(uint64_t t) {
+    if (sim_num_waits == SIM_CLOCK_MAX_WAITS) {
+        // Dropping a wait would let the clock jump past its deadline, no test result is worth that
+        fprintf(stderr, "Simulated clock: more than %d waits at once\n", SIM_CLOCK_MAX_WAITS);
+        abort();
+    }
+    sim_waits[sim_num_waits++] = t;
+    if (sim_attached) sim_blocked++;
+    sim_activity++;
+}
+
+// Call with sim_mutex held
+static void simRemoveWait(uint64_t t) {
+    for (int i = 0; i < sim_num_waits; i++) {
+        if (sim_waits[i] != t) continue;
+        sim_waits[i] = sim_waits[--sim_num_waits];
+        break;
+    }
+    if (sim_attached) sim_blocked--;
+    sim_activity++;
+}
+
+static void *simClockThread(void *arg) {
+    uint64_t seen = 0;
+    while (1) {
+        struct timespec quiet = { 0, SIM_CLOCK_QUIET_US * 1000L };
+        nanosleep(&quiet, NULL);
+        pthread_mutex_lock(&sim_mutex);
+        if (sim_activity == seen && sim_num_waits > 0 && sim_blocked >= sim_threads) {
+            uint64_t earliest = sim_waits[0];
+            for (int i = 1; i < sim_num_waits; i++) if (sim_waits[i] < earliest) earliest = sim_waits[i];
+            // Waits without a deadline only need the clock to stand still
+            if (earliest != UINT64_MAX && earliest > sim_now_ns) sim_now_ns = earliest;
+            pthread_cond_broadcast(&sim_cond);
+            sim_activity++;
+        }
+        seen = sim_activity;
+        pthread_mutex_unlock(&sim_mutex);
+    }
+    return NULL;
+}
+
+static void simStart(void) {
+    pthread_t thread;
+    pthread_create(&thread, NULL, simClockThread, NULL);
+    pthread_detach(thread);
+}
+
+static uint64_t simNowNs(void) {
+    return sim_now_ns;
+}
+
+static void simSleepUntilNs(uint64_t t) {
+    pthread_mutex_lock(&sim_mutex);
+    simAddWait(t);
+    while (sim_now_ns < t) pthread_cond_wait(&sim_cond, &sim_mutex);
+    simRemoveWait(t);
+    pthread_mutex_unlock(&sim_mutex);
+}
+
+static void simBeginWait(uint64_t t) {
+    pthread_mutex_lock(&sim_mutex);
+    simAddWait(t);
+    pthread_mutex_unlock(&sim_mutex);
+}
+
+static void simEndWait(uint64_t t) {
+    pthread_mutex_lock(&sim_mutex);
+    simRemoveWait(t);
+    pthread_mutex_unlock(&sim_mutex);
+}
+
+static void simAttachThread(void) {
+    pthread_mutex_lock(&sim_mutex);
+    if (!sim_attached) sim_threads++;
+    sim_attached = 1;
+    sim_activity++;
+    pthread_mutex_unlock(&sim_mutex);
+}
+
+static void simDetachThread(void) {
+    pthread_mutex_lock(&sim_mutex);
+    if (sim_attached) sim_threads--;
+    sim_attached = 0;
+    sim_activity++;
+    pthread_mutex_unlock(&sim_mutex);
+}
+
+const struct openrdm_clock openrdm_simulated_clock = {
+    .name = "simulated",
+    .start = simStart,
+    .now_ns = simNowNs,
+    .sleep_until_ns = simSleepUntilNs,
+    .begin_wait = simBeginWait,
+    .end_wait = simEndWait,
+    .attach_thread = simAttachThread,
+    .detach_thread = simDetachThread,
+    .wait_slice_ns = SIM_CLOCK_SLICE_US * 1000ULL,
+    .exact_sleep = 1,
+};
+
+static const struct openrdm_clock *clock_source = &openrdm_real_clock;
+
+void setClockOpenRDM(const struct openrdm_clock *clock) {
+    clock_source = clock;
+    if (clock->start) clock->start();
+}
+
+const struct openrdm_clock *getClockOpenRDM() {
+    return clock_source;
+}
+
+uint64_t monotonicNs() {
+    return clock_source->now_ns();
+}
+
+void attachThreadOpenRDM() {
+    clock_source->attach_thread();
+}
+
+void detachThreadOpenRDM() {
+    clock_source->detach_thread();
+}
+
+void sleepUntilNs(uint64_t t) {
+    clock_source->sleep_until_ns(t);
+}
+
+void waitUntilNs(uint64_t t) {
+    uint64_t now = monotonicNs();
+    if (now >= t) return;
+    if (clock_source->exact_sleep) {
+        sleepUntilNs(t);
+        return;
+    }
+    // Sleep through most of the interval, then spin out the part the scheduler can't hit
+    if (t - now > spin_threshold_ns) sleepUntilNs(t - spin_threshold_ns);
+    while (monotonicNs() < t);
+}
+
+void calibrateTimingOpenRDM(int verbose) {
+    if (clock_source->exact_sleep) {
+        spin_threshold_ns = 0;
+        return;
+    }
+    // Measure how late the scheduler wakes us up, this is how early we need to start spinning
+    uint64_t worst_ns = 0;
+    for (int i = 0; i < TIMING_CALIBRATION_SAMPLES; i++) {
+        uint64_t target = monotonicNs() + TIMING_CALIBRATION_SLEEP_NS;
+        sleepUntilNs(target);
+        uint64_t late_ns = monotonicNs() - target;
+        if (late_ns > worst_ns) worst_ns = late_ns;
+    }
+    spin_threshold_ns = worst_ns + TIMING_SPIN_MARGIN_NS;
+    if (spin_threshold_ns > TIMING_SPIN_MAX_NS) spin_threshold_ns = TIMING_SPIN_MAX_NS;
+    if (verbose) printf("Timing calibrated: worst wakeup latency %.1f us, spinning for %.1f us\n",
+        worst_ns / 1e3, spin_threshold_ns / 1e3);
+}
+
+uint64_t getSpinThresholdNs() { return spin_threshold_ns; }
+
+void recordInterval(struct openrdm_interval_stats *stats, uint64_t ns) {
+    if (stats->count == 0 || ns < stats->min_ns) stats->min_ns = ns;
+    if (ns > stats->max_ns) stats->max_ns = ns;
+    stats->total_ns += ns;
+    stats->total_sq_us += (ns / 1e3) * (ns / 1e3);
+    stats->count++;
+}
+
+double intervalStdDevUs(const struct openrdm_interval_stats *stats) {
+    if (stats->count == 0) return 0;
+    double mean_us = (double)stats->total_ns / stats->count / 1e3;
+    double variance = stats->total_sq_us / stats->count - mean_us * mean_us;
+    return variance > 0 ? sqrt(variance) : 0;
+}
@@ -0,0 +1,57 @@
+#ifndef __OPENRDM_TIMING_H__
+#define __OPENRDM_TIMING_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// Achieved interval statistics, min/max are only valid once count > 0
+struct openrdm_interval_stats {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    double total_sq_us; // Sum of squares in us^2, for the standard deviation
+};
+
+// Time source for everything timed in the node, swapped for a simulated one to run timing tests
+// without waiting on the wall clock
+struct openrdm_clock {
+    const char *name;
+    void (*start)(void);
+    uint64_t (*now_ns)(void);
+    void (*sleep_until_ns)(uint64_t t);
+    // Bracket a wait on something other than the clock that gives up at t, so a simulated clock knows to get to t
+    void (*begin_wait)(uint64_t t);
+    void (*end_wait)(uint64_t t); // t of UINT64_MAX for a wait with no deadline
+    // Threads doing timed work attach, a simulated clock holds still while any of them isn't waiting
+    void (*attach_thread)(void);
+    void (*detach_thread)(void);
+    uint64_t wait_slice_ns; // Longest real time such a wait may block before checking the clock again, 0 for no limit
+    int exact_sleep; // sleep_until_ns wakes exactly on time, so there is nothing to spin for
+};
+
+extern const struct openrdm_clock openrdm_real_clock;
+extern const struct openrdm_clock openrdm_simulated_clock;
+
+// Set before any thread starts timing anything
+void setClockOpenRDM(const struct openrdm_clock *clock);
+const struct openrdm_clock *getClockOpenRDM();
+
+uint64_t monotonicNs();
+void attachThreadOpenRDM(); // Call at the start and end of every thread that waits on the clock
+void detachThreadOpenRDM();
+void sleepUntilNs(uint64_t t); // Plain sleep, may wake up late
+void waitUntilNs(uint64_t t); // Sleep then spin, wakes up within the calibrated margin
+void calibrateTimingOpenRDM(int verbose);
+uint64_t getSpinThresholdNs();
+void recordInterval(struct openrdm_interval_stats *stats, uint64_t ns);
+double intervalStdDevUs(const struct openrdm_interval_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __OPENRDM_TIMING_H__
@@ -0,0 +1,65 @@
+#ifndef __OPENRDM_TRANSPORT_H__
+#define __OPENRDM_TRANSPORT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <poll.h>
+
+struct openrdm_context;
+
+// Device strings starting with this use a simulated transport instead of an FTDI device
+#define OPENRDM_STUB_PREFIX "stub"
+// Device strings starting with this use the kernel tty backend
+#define OPENRDM_TTY_PREFIX "/dev/"
+
+// The line operations openrdm.c needs from a device, functions return 0 or a negative error code
+// unless noted, write and read return the number of bytes transferred
+struct openrdm_transport {
+    const char *name;
+    int (*open)(int verbose, struct openrdm_context *ctx, const char *description);
+    void (*close)(struct openrdm_context *ctx);
+    // Puts the line back to 250kBaud 8N2 with empty buffers
+    int (*reset)(struct openrdm_context *ctx);
+    int (*set_break)(struct openrdm_context *ctx, int on);
+    int (*purge_rx)(struct openrdm_context *ctx);
+    int (*purge_tx)(struct openrdm_context *ctx);
+    // Returns once the device has taken the data, it may still be leaving the line
+    int (*write)(struct openrdm_context *ctx, unsigned char *data, int size);
+    // Starts a write that completes in wait, data must stay valid until then, NULL if unsupported
+    int (*submit)(struct openrdm_context *ctx, unsigned char *data, int size);
+    // Waits for a submitted write, and for the device to finish sending if it can tell us
+    int (*wait)(struct openrdm_context *ctx);
+    // Returns 1 once wait wouldn't block on a submitted write, 0 while it would, NULL if it can't tell
+    int (*done)(struct openrdm_context *ctx);
+    // Returns once size bytes are read, the line goes quiet after data or the deadline passes
+    int (*read)(struct openrdm_context *ctx, unsigned char *data, int size, uint64_t deadline_ns);
+    const char *(*error_str)(struct openrdm_context *ctx);
+    // USB bus the device is on, -1 if unknown or not a USB device
+    int (*bus_number)(struct openrdm_context *ctx);
+    // File descriptors that become ready when transfers complete, returns how many were filled in
+    int (*poll_fds)(struct openrdm_context *ctx, struct pollfd *fds, int max);
+    // Process completed transfers without blocking
+    void (*handle_events)(struct openrdm_context *ctx);
+};
+
+extern const struct openrdm_transport openrdm_ftdi_transport;
+extern const struct openrdm_transport openrdm_tty_transport;
+extern const struct openrdm_transport openrdm_stub_transport;
+
+// A responder on the simulated line, for tests. It is given each RDM request as sent, start code first,
+// and fills reply with what the line carries back, a break reading as a 0 byte, returning its length
+// or 0 for no reply. delay_ns is how long after the request has left the line the reply starts
+typedef int (*openrdm_stub_responder)(void *user, const unsigned char *request, int size,
+    unsigned char *reply, int max, uint64_t *delay_ns);
+void setStubResponderOpenRDM(openrdm_stub_responder responder, void *user);
+
+const struct openrdm_transport *selectTransportOpenRDM(const char *description);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __OPENRDM_TRANSPORT_H__
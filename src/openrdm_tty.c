@@ -0,0 +1,216 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "openrdm.h"
+#include "openrdm_transport.h"
+
+// Kernel tty transport for ftdi_sio or on-board UARTs, the device string is the tty path
+// termios2 is used for the 250kBaud custom rate, so this can't include <termios.h>
+
+#ifdef __linux__
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <asm/termbits.h>
+#include <linux/serial.h>
+
+// RDM responders may leave up to 2.1ms between slots, a longer gap ends the response
+#define TTY_READ_IDLE_US 2100
+
+static int ttyError(struct openrdm_context *ctx) {
+    ctx->tty_errno = errno;
+    // ftdi_sio returns EIO once the adapter is unplugged
+    if (errno == EIO || errno == ENODEV) return -ENODEV;
+    return -errno;
+}
+
+static int ttyReset(struct openrdm_context *ctx) {
+    struct termios2 tio;
+    if (ioctl(ctx->tty_fd, TCGETS2, &tio) < 0) return ttyError(ctx);
+    // Raw 8N2, a received break reads as a 0x00 like it does from libftdi
+    tio.c_iflag = 0;
+    tio.c_oflag = 0;
+    tio.c_lflag = 0;
+    tio.c_cflag = CS8 | CSTOPB | CREAD | CLOCAL | BOTHER;
+    tio.c_ispeed = BAUDRATE;
+    tio.c_ospeed = BAUDRATE;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    if (ioctl(ctx->tty_fd, TCSETS2, &tio) < 0) return ttyError(ctx);
+    if (ioctl(ctx->tty_fd, TCFLSH, TCIOFLUSH) < 0) return ttyError(ctx);
+    return 0;
+}
+
+static int ttyOpen(int verbose, struct openrdm_context *ctx, const char *description) {
+    ctx->tty_fd = open(description, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (ctx->tty_fd < 0) {
+        fprintf(stderr, "TTY ERROR %d: %s\n", errno, strerror(errno));
+        return ttyError(ctx);
+    }
+    ctx->tty_errno = 0;
+
+    // Let the kernel switch the RS485 driver around transmits, adapters that do this in
+    // hardware (like the OpenRDM's FTDI) and ptys don't support it, which is fine
+    struct serial_rs485 rs485;
+    memset(&rs485, 0, sizeof(rs485));
+    rs485.flags = SER_RS485_ENABLED | SER_RS485_RTS_ON_SEND;
+    if (ioctl(ctx->tty_fd, TIOCSRS485, &rs485) < 0) {
+        if (verbose) printf("RS485 direction control not available on %s: %s\n", description, strerror(errno));
+    }
+    return 0;
+}
+
+static void ttyClose(struct openrdm_context *ctx) {
+    if (ctx->tty_fd >= 0) close(ctx->tty_fd);
+    ctx->tty_fd = -1;
+}
+
+static int ttySetBreak(struct openrdm_context *ctx, int on) {
+    if (ioctl(ctx->tty_fd, on ? TIOCSBRK : TIOCCBRK) < 0) return ttyError(ctx);
+    return 0;
+}
+
+static int ttyPurgeRx(struct openrdm_context *ctx) {
+    if (ioctl(ctx->tty_fd, TCFLSH, TCIFLUSH) < 0) return ttyError(ctx);
+    return 0;
+}
+
+static int ttyPurgeTx(struct openrdm_context *ctx) {
+    if (ioctl(ctx->tty_fd, TCFLSH, TCOFLUSH) < 0) return ttyError(ctx);
+    return 0;
+}
+
+static int ttyWrite(struct openrdm_context *ctx, unsigned char *data, int size) {
+    int written = 0;
+    while (written < size) {
+        ssize_t ret = write(ctx->tty_fd, data + written, size - written);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) {
+                // Kernel buffer full, wait for room
+                struct pollfd pfd = { .fd = ctx->tty_fd, .events = POLLOUT };
+                poll(&pfd, 1, 50);
+                continue;
+            }
+            return ttyError(ctx);
+        }
+        written += ret;
+    }
+    return written;
+}
+
+// The kernel buffers writes, so a submit is just a write
+static int ttySubmit(struct openrdm_context *ctx, unsigned char *data, int size) {
+    return ttyWrite(ctx, data, size);
+}
+
+static int ttyWait(struct openrdm_context *ctx) {
+    // TCSBRK with a non zero argument is tcdrain, the break ioctls don't wait for the buffer
+    if (ioctl(ctx->tty_fd, TCSBRK, 1) < 0) {
+        return ttyError(ctx);
+    }
+    return 0;
+}
+
+// Done once the kernel has nothing left to send, as the tcdrain in wait would find
+static int ttyDone(struct openrdm_context *ctx) {
+    int queued;
+    if (ioctl(ctx->tty_fd, TIOCOUTQ, &queued) < 0) return 1; // Let wait report the error
+    return queued == 0;
+}
+
+static int ttyRead(struct openrdm_context *ctx, unsigned char *data, int size, uint64_t deadline_ns) {
+    int received = 0;
+    while (received < size) {
+        uint64_t now = monotonicNs();
+        if (now >= deadline_ns) break;
+        uint64_t wait_ns = deadline_ns - now;
+        if (received > 0 && wait_ns > TTY_READ_IDLE_US * 1000ULL) wait_ns = TTY_READ_IDLE_US * 1000ULL;
+        struct pollfd pfd = { .fd = ctx->tty_fd, .events = POLLIN };
+        int ret = poll(&pfd, 1, (int)((wait_ns + 999999) / 1000000));
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return ttyError(ctx);
+        }
+        if (ret == 0) {
+            if (received > 0) break; // Line went quiet
+            continue;
+        }
+        ssize_t n = read(ctx->tty_fd, data + received, size - received);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            return ttyError(ctx);
+        }
+        if (n == 0) {
+            // Hangup, the other end of a pty has gone
+            ctx->tty_errno = EIO;
+            return -ENODEV;
+        }
+        received += n;
+    }
+    return received;
+}
+
+static const char *ttyErrorStr(struct openrdm_context *ctx) {
+    return strerror(ctx->tty_errno);
+}
+
+// USB serial adapters have a usbN directory for their bus in the sysfs path of the tty
+static int ttyBusNumber(struct openrdm_context *ctx) {
+    char device[PATH_MAX], sysfs[PATH_MAX], path[PATH_MAX + 32];
+    // Resolve /dev/serial/by-id links to the tty name
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", ctx->tty_fd);
+    ssize_t len = readlink(path, device, sizeof(device)-1);
+    if (len < 0) return -1;
+    device[len] = 0;
+    const char *name = strrchr(device, '/');
+    snprintf(path, sizeof(path), "/sys/class/tty/%s/device", name ? name+1 : device);
+    if (!realpath(path, sysfs)) return -1;
+    for (const char *p = strstr(sysfs, "/usb"); p; p = strstr(p+1, "/usb")) {
+        int bus;
+        char sep;
+        if (sscanf(p, "/usb%d%c", &bus, &sep) == 2 && sep == '/') return bus;
+    }
+    return -1;
+}
+
+const struct openrdm_transport openrdm_tty_transport = {
+    .name = "TTY",
+    .open = ttyOpen,
+    .close = ttyClose,
+    .reset = ttyReset,
+    .set_break = ttySetBreak,
+    .purge_rx = ttyPurgeRx,
+    .purge_tx = ttyPurgeTx,
+    .write = ttyWrite,
+    .submit = ttySubmit,
+    .wait = ttyWait,
+    .done = ttyDone,
+    .read = ttyRead,
+    .error_str = ttyErrorStr,
+    .bus_number = ttyBusNumber,
+};
+
+#else
+
+// Only open is called when it fails
+static int ttyOpen(int verbose, struct openrdm_context *ctx, const char *description) {
+    fprintf(stderr, "TTY ERROR: tty devices are only supported on Linux\n");
+    return -1;
+}
+
+const struct openrdm_transport openrdm_tty_transport = {
+    .name = "TTY",
+    .open = ttyOpen,
+};
+
+#endif
@@ -6,8 +6,9 @@
 #include <string>
 #include <array>
 
+#include "dmx.h"
+
 // RDM Constants
-#define RDM_SUB_START_CODE 0x01
 #define RDM_UID_LENGTH 6
 #define RDM_CC_DISCOVER         0x10
 #define RDM_CC_DISCOVER_RESP    0x11
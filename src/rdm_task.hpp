@@ -0,0 +1,79 @@
+#ifndef __RDM_TASK_HPP__
+#define __RDM_TASK_HPP__
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <utility>
+
+// Coroutine for RDM work that spans several transactions. It is lazy: nothing runs until it is
+// awaited, then it resumes whoever awaited it once it returns. Every suspension point hands the
+// thread back to the device's scheduler, which is what lets DMX frames go out in between
+template <typename T>
+class RDMTask {
+    public:
+        struct promise_type {
+            T value{};
+            std::coroutine_handle<> continuation;
+            std::exception_ptr exception;
+
+            RDMTask get_return_object() { return RDMTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            auto final_suspend() noexcept {
+                struct Resume {
+                    bool await_ready() noexcept { return false; }
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                        auto continuation = h.promise().continuation;
+                        return continuation ? continuation : std::noop_coroutine();
+                    }
+                    void await_resume() noexcept {}
+                };
+                return Resume{};
+            }
+            void return_value(T v) { value = std::move(v); }
+            void unhandled_exception() { exception = std::current_exception(); }
+        };
+
+        RDMTask(RDMTask &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+        RDMTask(const RDMTask &) = delete;
+        ~RDMTask() { if (handle) handle.destroy(); }
+
+        bool await_ready() { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) {
+            handle.promise().continuation = caller;
+            return handle;
+        }
+        T await_resume() {
+            if (handle.promise().exception) std::rethrow_exception(handle.promise().exception);
+            return std::move(handle.promise().value);
+        }
+
+    private:
+        explicit RDMTask(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+        std::coroutine_handle<promise_type> handle;
+};
+
+// Runs a task to completion from outside any coroutine, setting result then calling done when it returns
+struct RDMTaskRunner {
+    struct promise_type {
+        RDMTaskRunner get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+template <typename T>
+RDMTaskRunner runRDMTask(RDMTask<T> task, std::shared_ptr<std::promise<T>> result, std::function<void()> done) {
+    try {
+        result->set_value(co_await task);
+    } catch (...) {
+        result->set_exception(std::current_exception());
+    }
+    if (done) done();
+}
+
+#endif // __RDM_TASK_HPP__
@@ -0,0 +1,45 @@
+#ifndef __SPSC_QUEUE_HPP__
+#define __SPSC_QUEUE_HPP__
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free FIFO between a single producer thread and a single consumer thread,
+// neither side ever waits for the other
+template <typename T, size_t Capacity>
+class SPSCQueue {
+    static_assert(Capacity > 0 && (Capacity & (Capacity-1)) == 0, "Capacity must be a power of 2");
+
+    public:
+        // Producer only, returns false if the queue is full
+        bool push(const T &item) {
+            size_t tail = tail_index.load(std::memory_order_relaxed);
+            if (tail - head_index.load(std::memory_order_acquire) == Capacity) return false;
+            items[tail & INDEX_MASK] = item;
+            tail_index.store(tail+1, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer only, returns false if the queue is empty
+        bool pop(T &item) {
+            size_t head = head_index.load(std::memory_order_relaxed);
+            if (head == tail_index.load(std::memory_order_acquire)) return false;
+            item = items[head & INDEX_MASK];
+            head_index.store(head+1, std::memory_order_release);
+            return true;
+        }
+
+        bool empty() const {
+            return head_index.load(std::memory_order_acquire) == tail_index.load(std::memory_order_acquire);
+        }
+
+    private:
+        static constexpr size_t INDEX_MASK = Capacity-1;
+        std::array<T, Capacity> items;
+        // On separate cache lines so the two threads don't bounce one between them
+        alignas(64) std::atomic<size_t> head_index = 0;
+        alignas(64) std::atomic<size_t> tail_index = 0;
+};
+
+#endif // __SPSC_QUEUE_HPP__
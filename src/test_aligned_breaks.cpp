@@ -0,0 +1,57 @@
+// Frames released together, the way ArtSync releases them, carry one start time and every port
+// starts its break on it, even though the ports' transfers queue up behind each other on the bus
+
+#include <cinttypes>
+#include <string>
+#include <vector>
+
+#include "openrdm_device.hpp"
+#include "test_check.hpp"
+
+#define PORTS 4
+#define ROUNDS 40
+#define REFRESH_PERIOD_US 25000
+#define SYNC_LEAD_US 2000 // Same lead as the node gives synced frames
+
+int main() {
+    setClockOpenRDM(&openrdm_simulated_clock);
+    std::vector<OpenRDMDevice> devices;
+    devices.reserve(PORTS);
+    for (int i = 0; i < PORTS; i++) {
+        devices.emplace_back(OPENRDM_STUB_PREFIX + std::to_string(i), false, false, false);
+    }
+    for (auto &dev : devices) CHECK(dev.init());
+
+    uint8_t frame[DMX_MAX_LENGTH+1] = {};
+    for (int i = 1; i <= DMX_MAX_LENGTH; i++) frame[i] = i;
+    uint64_t max_skew_ns = 0, max_late_ns = 0;
+    attachThreadOpenRDM();
+    uint64_t next_ns = monotonicNs() + REFRESH_PERIOD_US * 1000ULL;
+    for (int round = 0; round < ROUNDS; round++) {
+        waitUntilNs(next_ns);
+        uint64_t start_ns = monotonicNs() + SYNC_LEAD_US * 1000ULL;
+        for (auto &dev : devices) dev.writeDMX(frame, sizeof(frame), start_ns);
+        for (auto &dev : devices) dev.waitDMX();
+
+        uint64_t first_ns = UINT64_MAX, last_ns = 0;
+        for (auto &dev : devices) {
+            uint64_t break_ns = dev.getTimedBreakNs();
+            if (break_ns < first_ns) first_ns = break_ns;
+            if (break_ns > last_ns) last_ns = break_ns;
+        }
+        CHECK(first_ns >= start_ns);
+        if (last_ns - first_ns > max_skew_ns) max_skew_ns = last_ns - first_ns;
+        if (last_ns - start_ns > max_late_ns) max_late_ns = last_ns - start_ns;
+        next_ns += REFRESH_PERIOD_US * 1000ULL;
+    }
+    detachThreadOpenRDM();
+
+    printf("Synced breaks on %d ports: skew max %.1f us, late max %.1f us\n", PORTS, max_skew_ns / 1e3, max_late_ns / 1e3);
+    CHECK(max_skew_ns == 0);
+    CHECK(max_late_ns == 0);
+    for (auto &dev : devices) {
+        CHECK(dev.getStats().dmx_frames == ROUNDS);
+        dev.deinit();
+    }
+    return testResult();
+}
@@ -0,0 +1,22 @@
+#ifndef __TEST_CHECK_HPP__
+#define __TEST_CHECK_HPP__
+
+#include <cstdio>
+
+// Minimal checks for the make check programs, each test is one translation unit that returns
+// testResult() from main so every failed check gets reported, not just the first
+static int test_failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        test_failures++; \
+    } \
+} while (0)
+
+static inline int testResult() {
+    if (test_failures) fprintf(stderr, "%d check(s) failed\n", test_failures);
+    return test_failures ? 1 : 0;
+}
+
+#endif // __TEST_CHECK_HPP__
@@ -0,0 +1,46 @@
+// The vectorised DMX compare agrees with a byte at a time one for every length, alignment and
+// position of a difference
+
+#include <cstring>
+
+#include "dmx.h"
+#include "dmx_compare.hpp"
+#include "test_check.hpp"
+
+static bool scalarEqual(const uint8_t *a, const uint8_t *b, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (a[i] != b[i]) return false;
+    }
+    return true;
+}
+
+int main() {
+    // Room to start either side at any offset within a vector
+    uint8_t a[DMX_MAX_LENGTH+1+16], b[DMX_MAX_LENGTH+1+16];
+    for (size_t i = 0; i < sizeof(a); i++) a[i] = (i * 37) & 0xff;
+
+    int mismatches = 0;
+    for (size_t offset_a = 0; offset_a < 16; offset_a += 5) {
+        for (size_t offset_b = 0; offset_b < 16; offset_b += 3) {
+            for (size_t length = 0; length <= DMX_MAX_LENGTH+1; length++) {
+                memcpy(b + offset_b, a + offset_a, length);
+                if (!dmxDataEqual(a + offset_a, b + offset_b, length)) mismatches++;
+                // A single flipped bit in each position, including the scalar tail
+                for (size_t diff = 0; diff < length; diff++) {
+                    b[offset_b + diff] ^= 1 << (diff & 7);
+                    if (dmxDataEqual(a + offset_a, b + offset_b, length)
+                        != scalarEqual(a + offset_a, b + offset_b, length)) mismatches++;
+                    b[offset_b + diff] ^= 1 << (diff & 7);
+                }
+            }
+        }
+    }
+    CHECK(mismatches == 0);
+
+    // Differences past the length don't count
+    memcpy(b, a, sizeof(a));
+    b[100] ^= 0x80;
+    CHECK(dmxDataEqual(a, b, 100));
+    CHECK(!dmxDataEqual(a, b, 101));
+    return testResult();
+}
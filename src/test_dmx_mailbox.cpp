@@ -0,0 +1,81 @@
+// The DMX mailbox hands the reader the newest frame published, never a torn or older one
+
+#include <thread>
+
+#include "dmx_mailbox.hpp"
+#include "test_check.hpp"
+
+#define THREADED_FRAMES 200000
+
+static void fillFrame(DMXFrame &frame, uint32_t n) {
+    frame.length = DMX_MAX_LENGTH+1;
+    frame.data[0] = DMX_START_CODE;
+    for (int i = 1; i <= DMX_MAX_LENGTH; i++) frame.data[i] = (n + i) & 0xff;
+    frame.start_ns = n;
+}
+
+// Every slot agrees with the sequence number in start_ns, so a frame written while it was read shows up
+static bool frameIntact(const DMXFrame &frame) {
+    if (frame.length != DMX_MAX_LENGTH+1 || frame.data[0] != DMX_START_CODE) return false;
+    for (int i = 1; i <= DMX_MAX_LENGTH; i++) {
+        if (frame.data[i] != ((frame.start_ns + i) & 0xff)) return false;
+    }
+    return true;
+}
+
+static void checkLatestWins() {
+    DMXMailbox mailbox;
+    CHECK(!mailbox.pending());
+    CHECK(!mailbox.acquire());
+
+    for (uint32_t n = 1; n <= 3; n++) {
+        fillFrame(mailbox.back(), n);
+        mailbox.publish();
+    }
+    CHECK(mailbox.pending());
+    CHECK(mailbox.wait_until(std::chrono::steady_clock::now()));
+    CHECK(mailbox.acquire());
+    CHECK(mailbox.front().start_ns == 3);
+    CHECK(frameIntact(mailbox.front()));
+    CHECK(!mailbox.pending());
+    CHECK(!mailbox.acquire());
+    // The burst was one wakeup, and acquire took it
+    CHECK(!mailbox.wait_until(std::chrono::steady_clock::now()));
+
+    // The reader keeps front() until it acquires again, publishing doesn't touch it
+    fillFrame(mailbox.back(), 4);
+    mailbox.publish();
+    CHECK(mailbox.front().start_ns == 3);
+    CHECK(mailbox.acquire());
+    CHECK(mailbox.front().start_ns == 4);
+}
+
+static void checkThreaded() {
+    DMXMailbox mailbox;
+    auto writer = std::thread([&] {
+        for (uint32_t n = 1; n <= THREADED_FRAMES; n++) {
+            fillFrame(mailbox.back(), n);
+            mailbox.publish();
+        }
+    });
+    uint64_t last = 0;
+    bool in_order = true, intact = true;
+    while (last < THREADED_FRAMES) {
+        if (!mailbox.wait_until(std::chrono::steady_clock::now() + std::chrono::milliseconds(100))) continue;
+        if (!mailbox.acquire()) continue;
+        in_order &= mailbox.front().start_ns > last;
+        intact &= frameIntact(mailbox.front());
+        last = mailbox.front().start_ns;
+    }
+    writer.join();
+    CHECK(in_order);
+    CHECK(intact);
+    CHECK(last == THREADED_FRAMES);
+    CHECK(!mailbox.pending());
+}
+
+int main() {
+    checkLatestWins();
+    checkThreaded();
+    return testResult();
+}
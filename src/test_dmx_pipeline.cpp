@@ -0,0 +1,44 @@
+// Asynchronous frame writes on a stub device hand the frame over and return while it is still on the
+// line, and the next frame breaks as soon as it has left, where blocking writes wait out the transfer
+
+#include "openrdm.h"
+#include "test_check.hpp"
+
+#define FRAME_SIZE (DMX_MAX_LENGTH+1)
+#define FRAMES 20
+#define LINE_TIME_NS ((uint64_t)FRAME_SIZE * DMX_SLOT_TIME_US * 1000)
+
+static struct openrdm_stats writeFrames(int async) {
+    struct openrdm_context ctx;
+    clearOpenRDMContext(&ctx);
+    ctx.options.async = async;
+    CHECK(initOpenRDM(0, &ctx, OPENRDM_STUB_PREFIX "0"));
+    unsigned char frame[FRAME_SIZE] = { DMX_START_CODE };
+    for (int i = 0; i < FRAMES; i++) {
+        frame[1] = i;
+        CHECK(writeDMXOpenRDM(0, &ctx, frame, FRAME_SIZE, OPENRDM_STUB_PREFIX "0") == 0);
+        // Handed over, the frame is still leaving the line
+        if (async) CHECK(monotonicNs() < ctx.tx_complete_ns);
+    }
+    CHECK(waitDMXOpenRDM(0, &ctx, OPENRDM_STUB_PREFIX "0") == 0);
+    CHECK(monotonicNs() >= ctx.tx_complete_ns);
+    deinitOpenRDM(0, &ctx);
+    return ctx.stats;
+}
+
+int main() {
+    setClockOpenRDM(&openrdm_simulated_clock);
+
+    auto async = writeFrames(1);
+    auto sync = writeFrames(0);
+    printf("Break to handed over: async max %.1f us, sync min %.1f us\n",
+        async.tx_latency.max_ns / 1e3, sync.tx_latency.min_ns / 1e3);
+    CHECK(async.dmx_frames == FRAMES && sync.dmx_frames == FRAMES);
+    // From the break, an async write only blocks for the break and MAB, a blocking one for the USB transfer too
+    CHECK(async.tx_latency.max_ns < LINE_TIME_NS / 4);
+    CHECK(sync.tx_latency.min_ns > async.tx_latency.max_ns);
+    // Frames still go out back to back, a break after each has left the line
+    CHECK(async.frame_interval.min_ns >= LINE_TIME_NS);
+    CHECK(async.frame_interval.max_ns < LINE_TIME_NS + LINE_TIME_NS / 4);
+    return testResult();
+}
@@ -0,0 +1,87 @@
+// Frames are capped to max_slots and trimmed of trailing 0 slots, except that slots sent non zero
+// keep being sent for TRIM_HOLD_FRAMES frames so fixtures see them drop to 0
+
+#include "openrdm.h"
+#include "test_check.hpp"
+
+#define FRAME_SIZE (DMX_MAX_LENGTH+1)
+
+static void clearFrame(unsigned char *frame, int last_slot) {
+    for (int i = 0; i < FRAME_SIZE; i++) frame[i] = i <= last_slot ? 0xff : 0;
+    frame[0] = DMX_START_CODE;
+}
+
+static void checkCap() {
+    struct openrdm_context ctx;
+    clearOpenRDMContext(&ctx);
+    unsigned char frame[FRAME_SIZE];
+    clearFrame(frame, 20);
+    CHECK(dmxSizeOpenRDM(&ctx, frame, FRAME_SIZE) == FRAME_SIZE);
+    CHECK(dmxSizeOpenRDM(&ctx, frame, 1) == 1);
+
+    ctx.options.max_slots = 100;
+    CHECK(dmxSizeOpenRDM(&ctx, frame, FRAME_SIZE) == 101);
+    CHECK(dmxSizeOpenRDM(&ctx, frame, 51) == 51);
+}
+
+static void checkTrim() {
+    struct openrdm_context ctx;
+    clearOpenRDMContext(&ctx);
+    ctx.options.trim_slots = 1;
+    unsigned char frame[FRAME_SIZE];
+    clearFrame(frame, 40);
+    CHECK(dmxSizeOpenRDM(&ctx, frame, FRAME_SIZE) == 41);
+    clearFrame(frame, DMX_MAX_LENGTH);
+    CHECK(dmxSizeOpenRDM(&ctx, frame, FRAME_SIZE) == FRAME_SIZE);
+    clearFrame(frame, 0);
+    CHECK(dmxSizeOpenRDM(&ctx, frame, FRAME_SIZE) == 1);
+
+    // A 0 slot before the last non zero one stays
+    clearFrame(frame, 40);
+    frame[10] = 0;
+    CHECK(dmxSizeOpenRDM(&ctx, frame, FRAME_SIZE) == 41);
+
+    ctx.options.min_slots = 64;
+    CHECK(dmxSizeOpenRDM(&ctx, frame, FRAME_SIZE) == 65);
+    clearFrame(frame, 100);
+    CHECK(dmxSizeOpenRDM(&ctx, frame, FRAME_SIZE) == 101);
+    // Never more than the frame or the cap, whatever min_slots says
+    CHECK(dmxSizeOpenRDM(&ctx, frame, 33) == 33);
+    ctx.options.max_slots = 48;
+    CHECK(dmxSizeOpenRDM(&ctx, frame, FRAME_SIZE) == 49);
+}
+
+// Slots actually sent, through the frame write on a stub device
+static void checkTrimHold() {
+    struct openrdm_context ctx;
+    clearOpenRDMContext(&ctx);
+    ctx.options.trim_slots = 1;
+    CHECK(initOpenRDM(0, &ctx, OPENRDM_STUB_PREFIX "0"));
+    unsigned char frame[FRAME_SIZE];
+    auto sent = [&](int last_slot) {
+        clearFrame(frame, last_slot);
+        uint64_t slots = ctx.stats.dmx_slots;
+        CHECK(writeDMXOpenRDM(0, &ctx, frame, FRAME_SIZE, OPENRDM_STUB_PREFIX "0") == 0);
+        return ctx.stats.dmx_slots - slots;
+    };
+
+    CHECK(sent(200) == 200);
+    for (int i = 0; i < TRIM_HOLD_FRAMES; i++) CHECK(sent(50) == 200);
+    CHECK(sent(50) == 50);
+    // Growing takes effect straight away and restarts the hold
+    CHECK(sent(300) == 300);
+    CHECK(sent(0) == 300);
+    CHECK(sent(100) == 300);
+    CHECK(sent(20) == 300);
+    CHECK(sent(20) == 20);
+    deinitOpenRDM(0, &ctx);
+}
+
+int main() {
+    // Stub transfers take simulated time, so the frames don't take their time on the line
+    setClockOpenRDM(&openrdm_simulated_clock);
+    checkCap();
+    checkTrim();
+    checkTrimHold();
+    return testResult();
+}
@@ -0,0 +1,65 @@
+// The MPSC queue keeps each producer's items in order, refuses pushes when full and loses nothing
+// with several threads pushing at once
+
+#include <thread>
+#include <vector>
+
+#include "mpsc_queue.hpp"
+#include "test_check.hpp"
+
+#define PRODUCERS 4
+#define ITEMS_PER_PRODUCER 250000
+
+static void checkSingleThread() {
+    MPSCQueue<int, 4> queue;
+    int item = 0;
+    CHECK(!queue.pop(item));
+    for (int i = 0; i < 4; i++) CHECK(queue.push(i));
+    CHECK(!queue.push(4));
+    for (int lap = 0; lap < 3; lap++) {
+        for (int i = 0; i < 4; i++) {
+            CHECK(queue.pop(item));
+            CHECK(item == lap * 4 + i);
+            CHECK(queue.push(lap * 4 + i + 4));
+        }
+    }
+    for (int i = 0; i < 4; i++) CHECK(queue.pop(item) && item == 12 + i);
+    CHECK(!queue.pop(item));
+}
+
+// Items carry their producer in the top bits, each producer's sequence has to arrive in order
+static void checkThreaded() {
+    MPSCQueue<uint64_t, 64> queue;
+    auto producers = std::vector<std::thread>();
+    for (uint64_t p = 0; p < PRODUCERS; p++) {
+        producers.emplace_back([&queue, p] {
+            for (uint64_t i = 0; i < ITEMS_PER_PRODUCER; i++) {
+                while (!queue.push(p << 32 | i)) std::this_thread::yield();
+            }
+        });
+    }
+    uint64_t next[PRODUCERS] = {};
+    bool in_order = true;
+    for (uint64_t received = 0; received < PRODUCERS * ITEMS_PER_PRODUCER;) {
+        uint64_t item;
+        if (!queue.pop(item)) {
+            std::this_thread::yield();
+            continue;
+        }
+        uint64_t p = item >> 32;
+        in_order &= p < PRODUCERS && (item & 0xffffffff) == next[p];
+        if (p < PRODUCERS) next[p]++;
+        received++;
+    }
+    for (auto &producer : producers) producer.join();
+    CHECK(in_order);
+    for (int p = 0; p < PRODUCERS; p++) CHECK(next[p] == ITEMS_PER_PRODUCER);
+    uint64_t item;
+    CHECK(!queue.pop(item));
+}
+
+int main() {
+    checkSingleThread();
+    checkThreaded();
+    return testResult();
+}
@@ -0,0 +1,238 @@
+// Runs a stub device on the simulated clock against an emulated responder, checking that DMX refresh,
+// RDM retries and ACK_TIMER waits take the simulated time they should, and that a controller request
+// made during discovery is served at the next branch boundary
+
+#include <algorithm>
+#include <cinttypes>
+#include <future>
+#include <mutex>
+#include <vector>
+
+#include "openrdm_device.hpp"
+#include "test_check.hpp"
+
+#define REFRESH_PERIOD_US 25000
+#define REFRESH_FRAMES 400 // 10s of refresh
+#define RESPONDER_UID 0x7a7000000001ULL
+#define PROXIED_UID 0x7a7000000002ULL
+#define OTHER_UID 0x7a7080000000ULL // A plain responder, whose discovery replies collide with the proxy's
+#define RESPONDER_TURNAROUND_US 500
+#define RESPONDER_ACK_TIMER 5 // Tenths of a second the first PROXIED_DEVICES request is put off for
+#define RDM_PID_DEVICE_INFO 0x0060
+// Slack allowed on top of a timed wait for the USB transfers and line time of the transaction after it
+#define TRANSACTION_SLACK_US 10000
+
+// A proxy that misses its first mute and answers its first PROXIED_DEVICES request with ACK_TIMER,
+// and another responder on the same line
+struct Responder {
+    std::mutex mutex;
+    std::vector<std::pair<uint64_t, RDMPacket>> requests; // Every request for the proxy and when it was sent
+    bool muted = false;
+    bool other_muted = false;
+    bool missed_mute = false;
+    bool ack_timer_sent = false;
+    std::promise<void> *branched = nullptr; // Set by the next DISC_UNIQUE_BRANCH
+};
+
+static int writeDiscoveryReply(unsigned char *reply, UID src) {
+    int n = 0;
+    for (int i = 0; i < RDM_DUB_PREAMBLE_MAX; i++) reply[n++] = 0xFE;
+    reply[n++] = 0xAA;
+    uint8_t uid[RDM_UID_LENGTH];
+    writeUID(uid, src);
+    uint16_t checksum = 0;
+    for (int i = 0; i < RDM_UID_LENGTH; i++) {
+        reply[n++] = uid[i] | 0xAA;
+        reply[n++] = uid[i] | 0x55;
+        checksum += reply[n-2] + reply[n-1];
+    }
+    uint8_t checksum_bytes[2] = {(uint8_t)(checksum >> 8), (uint8_t)(checksum & 0xff)};
+    for (auto b : checksum_bytes) {
+        reply[n++] = b | 0xAA;
+        reply[n++] = b | 0x55;
+    }
+    return n;
+}
+
+static int writeReply(unsigned char *reply, RDMPacket &request, uint8_t resp_type, uint16_t pid, uint8_t pdl, const RDMPacketData &pdata) {
+    auto resp = RDMPacket(request.getSrc(), request.getDest(), request.transaction_number, resp_type, 0, 0,
+        request.cc + 1, pid, pdl, pdata);
+    auto data = RDMData();
+    size_t len = resp.writePacket(data);
+    reply[0] = 0; // Break
+    reply[1] = RDM_START_CODE;
+    std::copy_n(data.begin(), len, reply + 2);
+    return len + 2;
+}
+
+static int respond(void *user, const unsigned char *data, int size, unsigned char *reply, int max, uint64_t *delay_ns) {
+    auto *responder = (Responder *)user;
+    std::lock_guard<std::mutex> lock(responder->mutex);
+    *delay_ns = RESPONDER_TURNAROUND_US * 1000ULL;
+    auto request = RDMPacket(data, size);
+    if (!request.isValid()) return 0;
+    auto dest = request.getDest();
+    if (request.cc == RDM_CC_DISCOVER && request.pid == RDM_PID_DISC_UNIQUE_BRANCH) {
+        UID lower = getUID(&request.pdata[0]), upper = getUID(&request.pdata[RDM_UID_LENGTH]);
+        if (responder->branched) {
+            responder->branched->set_value();
+            responder->branched = nullptr;
+        }
+        bool proxy = !responder->muted && RESPONDER_UID >= lower && RESPONDER_UID <= upper;
+        bool other = !responder->other_muted && OTHER_UID >= lower && OTHER_UID <= upper;
+        if (!proxy && !other) return 0;
+        int n = writeDiscoveryReply(reply, proxy ? RESPONDER_UID : OTHER_UID);
+        // Colliding replies arrive garbled
+        if (proxy && other) reply[RDM_DUB_PREAMBLE_MAX+1] ^= 0x0F;
+        return n;
+    }
+    if (request.cc == RDM_CC_DISCOVER && request.pid == RDM_PID_DISC_UNMUTE && dest == RDM_UID_BROADCAST) {
+        responder->muted = false;
+        responder->other_muted = false;
+        return 0;
+    }
+    auto pdata = RDMPacketData();
+    if (request.cc == RDM_CC_DISCOVER && request.pid == RDM_PID_DISC_MUTE && dest == OTHER_UID) {
+        responder->other_muted = true;
+        return writeReply(reply, request, RDM_RESP_ACK, request.pid, 2, pdata);
+    }
+    if (dest != RESPONDER_UID) return 0;
+    responder->requests.emplace_back(monotonicNs(), request);
+
+    if (request.cc == RDM_CC_DISCOVER && request.pid == RDM_PID_DISC_MUTE) {
+        if (!responder->missed_mute) {
+            responder->missed_mute = true;
+            return 0;
+        }
+        responder->muted = true;
+        pdata[1] = RDM_CONTROL_MANAGED_PROXY_BITMASK;
+        return writeReply(reply, request, RDM_RESP_ACK, request.pid, 2, pdata);
+    }
+    if (request.cc == RDM_CC_GET_COMMAND && request.pid == RDM_PID_PROXIED_DEVICES && !responder->ack_timer_sent) {
+        responder->ack_timer_sent = true;
+        pdata[1] = RESPONDER_ACK_TIMER;
+        return writeReply(reply, request, RDM_RESP_ACK_TIMER, request.pid, 2, pdata);
+    }
+    if (request.cc == RDM_CC_GET_COMMAND && (request.pid == RDM_PID_PROXIED_DEVICES || request.pid == RDM_PID_QUEUED_MESSAGE)) {
+        writeUID(pdata.data(), PROXIED_UID);
+        return writeReply(reply, request, RDM_RESP_ACK, RDM_PID_PROXIED_DEVICES, RDM_UID_LENGTH, pdata);
+    }
+    if (request.cc == RDM_CC_GET_COMMAND && request.pid == RDM_PID_DEVICE_INFO) {
+        return writeReply(reply, request, RDM_RESP_ACK, request.pid, 0, pdata);
+    }
+    return 0;
+}
+
+// Frames on an absolute deadline clock, the way the node's continuous mode refreshes a port
+static void checkRefresh(OpenRDMDevice &dev) {
+    uint8_t frame[DMX_MAX_LENGTH+1] = {};
+    for (int i = 1; i <= DMX_MAX_LENGTH; i++) frame[i] = i;
+    attachThreadOpenRDM();
+    uint64_t t_start = monotonicNs();
+    uint64_t next_ns = t_start + REFRESH_PERIOD_US * 1000ULL;
+    for (int i = 0; i < REFRESH_FRAMES; i++) {
+        waitUntilNs(next_ns);
+        dev.writeDMX(frame, sizeof(frame), next_ns);
+        next_ns += REFRESH_PERIOD_US * 1000ULL;
+    }
+    dev.waitDMX();
+    detachThreadOpenRDM();
+
+    auto stats = dev.getStats();
+    printf("Refresh: %" PRIu64 " frames in %.3f s, interval min %.1f us, max %.1f us\n", stats.dmx_frames,
+        (monotonicNs() - t_start) / 1e9, stats.frame_interval.min_ns / 1e3, stats.frame_interval.max_ns / 1e3);
+    CHECK(stats.dmx_frames == REFRESH_FRAMES);
+    CHECK(stats.frame_interval.count == REFRESH_FRAMES - 1);
+    CHECK(stats.frame_interval.min_ns == REFRESH_PERIOD_US * 1000ULL);
+    CHECK(stats.frame_interval.max_ns == REFRESH_PERIOD_US * 1000ULL);
+}
+
+static void checkDiscovery(OpenRDMDevice &dev, Responder &responder) {
+    auto done = std::promise<void>();
+    CHECK(dev.startFullRDMDiscovery([&] { done.set_value(); }));
+    done.get_future().wait();
+    auto result = dev.pollRDMDiscovery();
+    CHECK(result.has_value());
+    if (result) {
+        auto &found = result->added;
+        CHECK(found.size() == 3);
+        CHECK(std::find(found.begin(), found.end(), RESPONDER_UID) != found.end());
+        CHECK(std::find(found.begin(), found.end(), PROXIED_UID) != found.end());
+        CHECK(std::find(found.begin(), found.end(), OTHER_UID) != found.end());
+    }
+
+    std::lock_guard<std::mutex> lock(responder.mutex);
+    auto &requests = responder.requests;
+    auto find = [&](size_t from, uint16_t pid) {
+        for (size_t i = from; i < requests.size(); i++) if (requests[i].second.pid == pid) return i;
+        return requests.size();
+    };
+
+    // The missed mute is retried once its response has timed out and the retry delay has passed
+    size_t mute = find(0, RDM_PID_DISC_MUTE), retry = find(mute + 1, RDM_PID_DISC_MUTE);
+    CHECK(retry < requests.size());
+    if (retry < requests.size()) {
+        uint64_t gap_us = (requests[retry].first - requests[mute].first) / 1000;
+        printf("Mute retry: %" PRIu64 " us after the missed mute\n", gap_us);
+        CHECK(gap_us >= RDM_READ_TIMEOUT_US + RDM_RETRY_DELAY_MS * 1000);
+        CHECK(gap_us < RDM_READ_TIMEOUT_US + RDM_RETRY_DELAY_MS * 1000 + TRANSACTION_SLACK_US);
+    }
+    auto uid_stats = dev.getUIDStats();
+    CHECK(uid_stats[RESPONDER_UID].retries == 1);
+
+    // The QUEUED_MESSAGE poll goes out once the ACK_TIMER delay has passed
+    size_t get = find(0, RDM_PID_PROXIED_DEVICES), poll = find(get + 1, RDM_PID_QUEUED_MESSAGE);
+    CHECK(poll < requests.size());
+    if (poll < requests.size()) {
+        uint64_t gap_us = (requests[poll].first - requests[get].first) / 1000;
+        printf("ACK_TIMER: QUEUED_MESSAGE %" PRIu64 " us after the request\n", gap_us);
+        CHECK(gap_us >= RESPONDER_ACK_TIMER * 100000ULL);
+        CHECK(gap_us < RESPONDER_ACK_TIMER * 100000ULL + TRANSACTION_SLACK_US);
+    }
+    auto rdm_stats = dev.getRDMStats();
+    CHECK(rdm_stats.ack_timers == 1);
+    CHECK(rdm_stats.ack_timers_pending == 0);
+}
+
+static void checkControllerRequest(OpenRDMDevice &dev, Responder &responder) {
+    auto pauses = dev.getRDMStats().pauses;
+    auto branched = std::promise<void>();
+    responder.mutex.lock();
+    responder.branched = &branched;
+    responder.mutex.unlock();
+    auto done = std::promise<void>();
+    CHECK(dev.startFullRDMDiscovery([&] { done.set_value(); }));
+    branched.get_future().wait();
+
+    auto request = RDMPacket(RESPONDER_UID, 0, 0, 1, 0, 0, RDM_CC_GET_COMMAND, RDM_PID_DEVICE_INFO, 0, RDMPacketData());
+    auto request_data = RDMData();
+    size_t request_len = request.writePacket(request_data);
+    auto [resp_len, resp] = dev.writeRDM(request_data.data(), request_len);
+    CHECK(resp_len > 0);
+    CHECK(RDMPacket(resp.data(), resp_len).pid == RDM_PID_DEVICE_INFO);
+
+    done.get_future().wait();
+    auto result = dev.pollRDMDiscovery();
+    CHECK(result && result->added.size() == 3);
+    auto stats = dev.getRDMStats();
+    CHECK(stats.pauses == pauses + 1);
+    CHECK(stats.controller_latency.count == 1);
+    // It waits for the branch in progress, then takes one transaction of its own
+    printf("Controller request during discovery: served in %.1f us\n", stats.controller_latency.max_ns / 1e3);
+    CHECK(stats.controller_latency.max_ns < 2 * TRANSACTION_SLACK_US * 1000ULL);
+}
+
+int main() {
+    setClockOpenRDM(&openrdm_simulated_clock);
+    auto responder = Responder();
+    setStubResponderOpenRDM(respond, &responder);
+
+    OpenRDMDevice dev(OPENRDM_STUB_PREFIX "0", false, true, false);
+    CHECK(dev.init());
+    if (!dev.isInitialized()) return testResult();
+    checkRefresh(dev);
+    checkDiscovery(dev, responder);
+    checkControllerRequest(dev, responder);
+    dev.deinit();
+    return testResult();
+}
@@ -0,0 +1,56 @@
+// The SPSC queue keeps FIFO order, refuses pushes when full and loses nothing between two threads
+
+#include <thread>
+
+#include "spsc_queue.hpp"
+#include "test_check.hpp"
+
+#define THREADED_ITEMS 1000000
+
+static void checkSingleThread() {
+    SPSCQueue<int, 4> queue;
+    int item = 0;
+    CHECK(queue.empty());
+    CHECK(!queue.pop(item));
+    for (int i = 0; i < 4; i++) CHECK(queue.push(i));
+    CHECK(!queue.push(4));
+    // Wraps around the ring in order
+    for (int lap = 0; lap < 3; lap++) {
+        for (int i = 0; i < 4; i++) {
+            CHECK(queue.pop(item));
+            CHECK(item == lap * 4 + i);
+            CHECK(queue.push(lap * 4 + i + 4));
+        }
+    }
+    for (int i = 0; i < 4; i++) CHECK(queue.pop(item) && item == 12 + i);
+    CHECK(queue.empty());
+}
+
+static void checkThreaded() {
+    SPSCQueue<uint64_t, 64> queue;
+    auto producer = std::thread([&] {
+        for (uint64_t i = 0; i < THREADED_ITEMS; i++) {
+            while (!queue.push(i)) std::this_thread::yield();
+        }
+    });
+    uint64_t next = 0;
+    bool in_order = true;
+    while (next < THREADED_ITEMS) {
+        uint64_t item;
+        if (!queue.pop(item)) {
+            std::this_thread::yield();
+            continue;
+        }
+        in_order &= item == next;
+        next++;
+    }
+    producer.join();
+    CHECK(in_order);
+    CHECK(queue.empty());
+}
+
+int main() {
+    checkSingleThread();
+    checkThreaded();
+    return testResult();
+}
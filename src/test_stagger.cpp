@@ -0,0 +1,71 @@
+// Ports on one USB bus refreshing in step queue their transfers behind each other every frame,
+// spread across the refresh period the way --stagger spreads them they each get the bus to themselves
+
+#include <algorithm>
+#include <cinttypes>
+#include <string>
+#include <vector>
+
+#include "openrdm_device.hpp"
+#include "test_check.hpp"
+
+#define PORTS 4
+#define FRAMES 40
+#define REFRESH_PERIOD_US 25000
+
+// Refreshes PORTS fresh simulated ports for FRAMES periods, staggered or in step, and returns their stats
+static std::vector<struct openrdm_stats> refresh(bool stagger) {
+    std::vector<OpenRDMDevice> devices;
+    devices.reserve(PORTS);
+    for (int i = 0; i < PORTS; i++) {
+        devices.emplace_back(OPENRDM_STUB_PREFIX + std::to_string(i), false, false, false);
+    }
+    for (auto &dev : devices) CHECK(dev.init());
+    // Simulated ports share one bus, so --stagger puts them all in one group
+    for (auto &dev : devices) CHECK(dev.getBusNumber() == devices[0].getBusNumber());
+
+    uint8_t frame[DMX_MAX_LENGTH+1] = {};
+    for (int i = 1; i <= DMX_MAX_LENGTH; i++) frame[i] = i;
+
+    attachThreadOpenRDM();
+    // Same grid as the node: port index of count on a bus starts index/count of a period after a common origin
+    uint64_t origin_ns = monotonicNs() + REFRESH_PERIOD_US * 1000ULL;
+    for (int n = 0; n < FRAMES; n++) {
+        for (int i = 0; i < PORTS; i++) {
+            uint64_t start_ns = origin_ns + n * REFRESH_PERIOD_US * 1000ULL;
+            if (stagger) start_ns += (uint64_t)i * REFRESH_PERIOD_US * 1000ULL / PORTS;
+            waitUntilNs(start_ns);
+            devices[i].writeDMX(frame, sizeof(frame), start_ns);
+        }
+    }
+    for (auto &dev : devices) dev.waitDMX();
+    detachThreadOpenRDM();
+
+    std::vector<struct openrdm_stats> stats;
+    for (auto &dev : devices) {
+        stats.push_back(dev.getStats());
+        CHECK(stats.back().dmx_frames == FRAMES);
+        dev.deinit();
+    }
+    return stats;
+}
+
+int main() {
+    setClockOpenRDM(&openrdm_simulated_clock);
+    auto aligned = refresh(false);
+    auto staggered = refresh(true);
+
+    uint64_t aligned_max_ns = 0, staggered_max_ns = 0, staggered_min_ns = UINT64_MAX;
+    for (int i = 0; i < PORTS; i++) {
+        aligned_max_ns = std::max(aligned_max_ns, aligned[i].tx_latency.max_ns);
+        staggered_max_ns = std::max(staggered_max_ns, staggered[i].tx_latency.max_ns);
+        staggered_min_ns = std::min(staggered_min_ns, staggered[i].tx_latency.min_ns);
+    }
+    printf("TX latency max on %d ports: in step %.1f us, staggered %.1f us\n", PORTS,
+        aligned_max_ns / 1e3, staggered_max_ns / 1e3);
+    // In step, every port but the first waits for the bus at least one transfer's worth
+    CHECK(staggered_max_ns < aligned_max_ns);
+    // Staggered, nothing else is on the bus, every frame takes the same time
+    CHECK(staggered_max_ns == staggered_min_ns);
+    return testResult();
+}
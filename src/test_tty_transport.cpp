@@ -0,0 +1,111 @@
+// The kernel tty transport on a pty pair: DMX frames reach the other end intact, and an RDM
+// request written to the line gets the response played back from the other end, read up to its
+// checksum and no further
+
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "openrdm.h"
+#include "rdm.hpp"
+#include "test_check.hpp"
+
+#define FRAME_SIZE (DMX_MAX_LENGTH+1)
+#define PTY_READ_TIMEOUT_MS 1000
+#define RESPONDER_UID 0x7a7000000001ULL
+#define CONTROLLER_UID 0x7a70000000ffULL
+#define TRAILING_BYTES 8 // Line noise after the response
+
+// Reads exactly size bytes from the far end of the pty, false if they don't arrive in time
+static bool readPty(int fd, unsigned char *data, size_t size) {
+    size_t received = 0;
+    while (received < size) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, PTY_READ_TIMEOUT_MS) <= 0) return false;
+        ssize_t n = read(fd, data + received, size - received);
+        if (n <= 0) return false;
+        received += n;
+    }
+    return true;
+}
+
+static void checkDMX(struct openrdm_context &ctx, int master, const char *path) {
+    unsigned char frame[FRAME_SIZE];
+    for (int i = 0; i < FRAME_SIZE; i++) frame[i] = i * 7;
+    frame[0] = DMX_START_CODE;
+    for (int n = 0; n < 3; n++) {
+        frame[1] = n;
+        CHECK(writeDMXOpenRDM(0, &ctx, frame, FRAME_SIZE, path) == 0);
+        CHECK(waitDMXOpenRDM(0, &ctx, path) == 0);
+        unsigned char line[FRAME_SIZE];
+        CHECK(readPty(master, line, FRAME_SIZE));
+        CHECK(memcmp(line, frame, FRAME_SIZE) == 0);
+    }
+    CHECK(ctx.stats.dmx_frames == 3);
+}
+
+// Plays the responder: reads the request off the line and answers with reply
+static std::thread respondWith(int master, size_t request_size, std::vector<unsigned char> reply) {
+    return std::thread([=] {
+        std::vector<unsigned char> request(request_size);
+        if (readPty(master, request.data(), request_size)) {
+            if (write(master, reply.data(), reply.size()) != (ssize_t)reply.size()) return;
+        }
+    });
+}
+
+static void checkRDM(struct openrdm_context &ctx, int master, const char *path, bool trailing) {
+    auto request = RDMPacket(RESPONDER_UID, CONTROLLER_UID, 1, 1, 0, 0, RDM_CC_GET_COMMAND, 0x0060, 0, RDMPacketData());
+    auto request_data = RDMData();
+    size_t request_len = request.writePacket(request_data);
+
+    auto response = RDMPacket(CONTROLLER_UID, RESPONDER_UID, 1, RDM_RESP_ACK, 0, 0, RDM_CC_GET_COMMAND_RESP, 0x0060, 0, RDMPacketData());
+    auto response_data = RDMData();
+    size_t response_len = response.writePacket(response_data);
+    auto reply = std::vector<unsigned char>(2 + response_len);
+    reply[0] = 0; // Break, then the response
+    reply[1] = RDM_START_CODE;
+    memcpy(reply.data() + 2, response_data.data(), response_len);
+    // Anything after the checksum arrives with the response, but isn't part of it
+    if (trailing) reply.insert(reply.end(), TRAILING_BYTES, 0x55);
+
+    auto responder = respondWith(master, request_len + 1, reply);
+    unsigned char rx[FRAME_SIZE];
+    int ret = writeRDMOpenRDM(0, &ctx, request_data.data(), request_len, 0, 1, rx, 0, path);
+    responder.join();
+    CHECK(ret == (int)response_len + 1);
+    CHECK(RDMPacket(rx, ret).isValid());
+    CHECK(rx[0] == RDM_START_CODE);
+}
+
+int main() {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+        perror("No pty available");
+        return 77; // Skipped
+    }
+    struct termios tio;
+    tcgetattr(master, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(master, TCSANOW, &tio);
+    const char *path = ptsname(master);
+
+    struct openrdm_context ctx;
+    clearOpenRDMContext(&ctx);
+    CHECK(initOpenRDM(0, &ctx, path));
+    if (!ctx.opened) return testResult();
+    CHECK(ctx.transport == &openrdm_tty_transport);
+    checkDMX(ctx, master, path);
+    checkRDM(ctx, master, path, false);
+    checkRDM(ctx, master, path, true);
+    CHECK(ctx.stats.rdm_response_time.count == 2);
+    deinitOpenRDM(0, &ctx);
+    close(master);
+    return testResult();
+}